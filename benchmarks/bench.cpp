@@ -0,0 +1,175 @@
+/*!
+ * Small benchmark driver. Runs Lox scripts from the benchmarks directory
+ * on both engines, as well as the front end on generated sources,
+ * and reports the median wall time of several runs.
+ * Usage: lox_bench [filter], only benchmarks whose name contains
+ * the filter are run.
+ */
+
+#include "lox.h"
+#include "parser.h"
+#include "scanner.h"
+#include "source_buffer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <string>
+#include <vector>
+
+namespace {
+
+/**
+ * A named benchmark case, run() executes one iteration
+ */
+struct Benchmark {
+    std::string name;
+    std::function<void()> run;
+};
+
+constexpr int NUM_RUNS = 5;
+
+void runScript(const std::string& filename, Engine engine) {
+    std::stringstream out;
+    std::stringstream err;
+    auto interpreter = std::make_shared<LoxInterpreter>(&out, &err);
+    interpreter->setEngine(engine);
+    interpreter->runFile(filename.c_str());
+
+    if (!err.str().empty()) {
+        std::cerr << filename << ": " << err.str();
+    }
+}
+
+void addScript(std::vector<Benchmark>& benchmarks, const std::string& name) {
+    const std::string filename = "benchmarks/" + name + ".lox";
+    benchmarks.push_back({name + "/ast", [=] { runScript(filename, Engine::TREE_WALKER); }});
+    benchmarks.push_back({name + "/vm", [=] { runScript(filename, Engine::BYTECODE_VM); }});
+}
+
+/**
+ * Generate a large source dense in identifiers and keywords
+ * @param lines number of lines
+ * @return source text
+ */
+std::string identifierSource(int lines) {
+    std::string source;
+    for (int i = 0; i < lines; ++i) {
+        const auto n = std::to_string(i);
+        source += "fun compute_" + n + "(first, second) { var result_" + n + " = first and second or nil; "
+                  "while (result_" + n + " != false) { result_" + n + " = this.field_" + n + "; } "
+                  "return result_" + n + "; }\n";
+    }
+    return source;
+}
+
+/**
+ * Generate a large source consisting mostly of comments, indentation and long string literals
+ * @param lines number of lines
+ * @return source text
+ */
+std::string commentSource(int lines) {
+    std::string source;
+    for (int i = 0; i < lines; ++i) {
+        source += "        // Explains at some length what the statement on the next line does\n"
+                  "        print \"A string literal that is long enough to span several blocks\";\n";
+    }
+    return source;
+}
+
+void addScanner(std::vector<Benchmark>& benchmarks, const std::string& name, std::string text) {
+    auto source = std::make_shared<const SourceBuffer>(std::move(text));
+    benchmarks.push_back({"scan/" + name, [=] {
+        std::stringstream out;
+        std::stringstream err;
+        auto interpreter = std::make_shared<LoxInterpreter>(&out, &err);
+        Scanner scanner{source, interpreter};
+        while (scanner.nextToken().getType() != TokenType::EOF_TYPE) {}
+    }});
+}
+
+void addParser(std::vector<Benchmark>& benchmarks, const std::string& name, std::string text) {
+    auto source = std::make_shared<const SourceBuffer>(std::move(text));
+    benchmarks.push_back({"parse/" + name, [=] {
+        std::stringstream out;
+        std::stringstream err;
+        auto interpreter = std::make_shared<LoxInterpreter>(&out, &err);
+        AstArena arena;
+        Parser parser{Scanner{source, interpreter}, arena, interpreter};
+        parser.parse();
+    }});
+}
+
+/**
+ * Generate a bundle of independent top-level functions and a call of the last one
+ * @param functions number of functions
+ * @return source text
+ */
+std::string functionSource(int functions) {
+    std::string source;
+    for (int i = 0; i < functions; ++i) {
+        const auto n = std::to_string(i);
+        source += "fun function_" + n + "(a, b) { var sum = a + b; if (sum > " + n + ") { return sum; } "
+                  "return \"result " + n + "\"; }\n";
+    }
+    source += "print function_" + std::to_string(functions - 1) + "(1, 2);\n";
+    return source;
+}
+
+void addStartup(std::vector<Benchmark>& benchmarks, const std::string& name, std::string text, unsigned threads) {
+    auto source = std::make_shared<const SourceBuffer>(std::move(text));
+    benchmarks.push_back({"startup/" + name, [=] {
+        std::stringstream out;
+        std::stringstream err;
+        auto interpreter = std::make_shared<LoxInterpreter>(&out, &err);
+        interpreter->setParseThreads(threads);
+        interpreter->run(source, false);
+    }});
+}
+
+double medianMilliseconds(const Benchmark& benchmark) {
+    std::vector<double> times;
+    for (int i = 0; i < NUM_RUNS; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        benchmark.run();
+        auto end = std::chrono::steady_clock::now();
+        times.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+    }
+
+    std::sort(times.begin(), times.end());
+    return times[times.size() / 2];
+}
+
+}
+
+int main(int argc, const char* argv[]) {
+    const std::string filter = argc > 1 ? argv[1] : "";
+
+    std::vector<Benchmark> benchmarks;
+    addScript(benchmarks, "calls");
+    addScript(benchmarks, "loops");
+    addScript(benchmarks, "objects");
+    addScript(benchmarks, "closures");
+    addScript(benchmarks, "strings");
+    addScript(benchmarks, "concat");
+    addScript(benchmarks, "numbers");
+    addScanner(benchmarks, "identifiers", identifierSource(100000));
+    addScanner(benchmarks, "comments", commentSource(100000));
+    addParser(benchmarks, "functions", identifierSource(100000));
+    addStartup(benchmarks, "functions-50k/serial", functionSource(50000), 1);
+    addStartup(benchmarks, "functions-50k/parallel", functionSource(50000),
+               std::max(std::thread::hardware_concurrency(), 2u));
+
+    for (const auto& benchmark : benchmarks) {
+        if (benchmark.name.find(filter) == std::string::npos) { continue; }
+        std::cout << std::left << std::setw(32) << benchmark.name
+                  << std::right << std::setw(12) << std::fixed << std::setprecision(2)
+                  << medianMilliseconds(benchmark) << " ms" << std::endl;
+    }
+
+    return 0;
+}
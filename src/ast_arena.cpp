@@ -0,0 +1,47 @@
+#include "ast_arena.h"
+#include "expressions.h"
+#include "statements.h"
+
+#include <algorithm>
+
+void AstNodeDeleter::operator()(Expression* node) const {
+    node->~Expression();
+}
+
+void AstNodeDeleter::operator()(Statement* node) const {
+    node->~Statement();
+}
+
+static_assert(AstArena::ALIGNMENT <= __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+
+void* AstArena::allocate(std::size_t size) {
+    size = (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+
+    if (size > remaining_) {
+        chunkSize_ = std::clamp(chunkSize_ * 2, MIN_CHUNK_SIZE, MAX_CHUNK_SIZE);
+        const auto chunk_size = std::max(chunkSize_, size);
+        // operator new[] of std::byte is aligned to the default new alignment
+        chunks_.emplace_back(new std::byte[chunk_size]);
+        next_ = chunks_.back().get();
+        remaining_ = chunk_size;
+    }
+
+    void* memory = next_;
+    next_ += size;
+    remaining_ -= size;
+    bytesAllocated_ += size;
+    return memory;
+}
+
+void AstArena::adopt(AstArena& other) {
+    for (auto& chunk : other.chunks_) {
+        chunks_.push_back(std::move(chunk));
+    }
+    bytesAllocated_ += other.bytesAllocated_;
+
+    other.chunks_.clear();
+    other.chunkSize_ = 0;
+    other.next_ = nullptr;
+    other.remaining_ = 0;
+    other.bytesAllocated_ = 0;
+}
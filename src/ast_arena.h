@@ -0,0 +1,89 @@
+#ifndef LOX_AST_ARENA_H
+#define LOX_AST_ARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+class Expression;
+class Statement;
+
+/*!
+ * Deleter of AST nodes, only runs the destructor.
+ * The memory belongs to the arena the node was created in.
+ * Destructors of both node hierarchies are virtual, so nodes are destroyed
+ * through their base, which works for members of not yet defined node types
+ */
+struct AstNodeDeleter {
+    void operator()(Expression* node) const;
+    void operator()(Statement* node) const;
+};
+
+/*!
+ * Owning reference to an AST node allocated in an AstArena
+ */
+template<class T>
+using AstPtr = std::unique_ptr<T, AstNodeDeleter>;
+
+/*!
+ * Bump allocator for the AST of one program.
+ * Nodes are placed one after another in chunks, so a tree walk touches
+ * a few contiguous blocks instead of one heap allocation per node. The
+ * chunks are released all at once when the arena is destroyed, which
+ * has to happen after all nodes in it are destroyed.
+ */
+class AstArena {
+public:
+    constexpr static std::size_t ALIGNMENT = alignof(std::max_align_t);
+    constexpr static std::size_t MIN_CHUNK_SIZE = 1024;
+    constexpr static std::size_t MAX_CHUNK_SIZE = 64 * 1024;
+
+    AstArena() = default;
+
+    AstArena(const AstArena&) = delete;
+    AstArena& operator=(const AstArena&) = delete;
+
+    /**
+     * Create node in the arena
+     * @tparam T node type
+     * @param args constructor arguments
+     * @return owning reference to the node
+     */
+    template<class T, class... Args>
+    AstPtr<T> make(Args&&... args) {
+        static_assert(alignof(T) <= ALIGNMENT);
+        return AstPtr<T>{new(allocate(sizeof(T))) T(std::forward<Args>(args)...)};
+    }
+
+    /**
+     * Get memory for a node
+     * @param size size of the node in bytes
+     * @return block of at least size bytes, aligned to ALIGNMENT
+     */
+    void* allocate(std::size_t size);
+
+    /**
+     * Take over the memory of another arena, its nodes stay valid as long as this arena
+     * @param other arena to empty
+     */
+    void adopt(AstArena& other);
+
+    /**
+     * Get size of the nodes allocated so far
+     * @return size in bytes
+     */
+    [[nodiscard]] std::size_t getBytesAllocated() const { return bytesAllocated_; }
+
+private:
+    // Chunks grow from MIN_CHUNK_SIZE, so the arena of a short REPL line stays small
+    std::vector<std::unique_ptr<std::byte[]>> chunks_;
+    std::size_t chunkSize_ = 0;
+    std::byte* next_ = nullptr;
+    std::size_t remaining_ = 0;
+    std::size_t bytesAllocated_ = 0;
+};
+
+
+#endif //LOX_AST_ARENA_H
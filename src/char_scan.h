@@ -0,0 +1,190 @@
+#ifndef LOX_CHAR_SCAN_H
+#define LOX_CHAR_SCAN_H
+
+#include <bit>
+#include <cstddef>
+#include <string_view>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+ * Searches over runs of source characters used by the scanner.
+ * Where SSE2 is available, 16 characters are classified at once into a bit mask,
+ * the run ends at the first zero bit and newlines are counted with a popcount.
+ * The remaining characters, and all of them on other targets, take the scalar loop.
+ */
+
+constexpr bool isWhitespaceChar(char c) {
+    return c == ' ' || c == '\r' || c == '\t' || c == '\n';
+}
+
+constexpr bool isIdentifierChar(char c) {
+    return (c >= 'a' && c <= 'z') ||
+           (c >= 'A' && c <= 'Z') ||
+           (c >= '0' && c <= '9') ||
+           c == '_';
+}
+
+#if defined(__SSE2__)
+namespace simd {
+
+constexpr std::size_t BLOCK_SIZE = 16;
+constexpr unsigned FULL_MASK = 0xFFFF;
+
+inline __m128i load(std::string_view text, std::size_t pos) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(text.data() + pos));
+}
+
+inline unsigned equalMask(__m128i block, char c) {
+    return static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8(c))));
+}
+
+// Compares are signed, which is fine for ranges of ASCII characters
+inline unsigned rangeMask(__m128i block, char low, char high) {
+    const auto above = _mm_cmpgt_epi8(block, _mm_set1_epi8(static_cast<char>(low - 1)));
+    const auto below = _mm_cmplt_epi8(block, _mm_set1_epi8(static_cast<char>(high + 1)));
+    return static_cast<unsigned>(_mm_movemask_epi8(_mm_and_si128(above, below)));
+}
+
+inline unsigned bitsBelow(unsigned index) {
+    return (1u << index) - 1;
+}
+
+}
+#endif
+
+/**
+ * Skip spaces, tabs, carriage returns and newlines
+ * @param text source text
+ * @param pos position to start at
+ * @param line line counter, incremented for every newline skipped
+ * @return position of the first other character, size of the text if there is none
+ */
+inline std::size_t skipWhitespace(std::string_view text, std::size_t pos, int& line) {
+    // Most tokens are separated by a single space or none at all
+    if (pos < text.size() && !isWhitespaceChar(text[pos])) { return pos; }
+
+#if defined(__SSE2__)
+    while (pos + simd::BLOCK_SIZE <= text.size()) {
+        const auto block = simd::load(text, pos);
+        const unsigned newlines = simd::equalMask(block, '\n');
+        const unsigned whitespace = newlines | simd::equalMask(block, ' ') |
+                                    simd::equalMask(block, '\t') | simd::equalMask(block, '\r');
+        if (whitespace != simd::FULL_MASK) {
+            const auto length = static_cast<unsigned>(std::countr_one(whitespace));
+            line += std::popcount(newlines & simd::bitsBelow(length));
+            return pos + length;
+        }
+        line += std::popcount(newlines);
+        pos += simd::BLOCK_SIZE;
+    }
+#endif
+
+    for (; pos < text.size() && isWhitespaceChar(text[pos]); ++pos) {
+        if (text[pos] == '\n') { ++line; }
+    }
+    return pos;
+}
+
+/**
+ * Skip letters, digits and underscores
+ * @param text source text
+ * @param pos position to start at
+ * @return position of the first other character, size of the text if there is none
+ */
+inline std::size_t skipIdentifier(std::string_view text, std::size_t pos) {
+#if defined(__SSE2__)
+    while (pos + simd::BLOCK_SIZE <= text.size()) {
+        const auto block = simd::load(text, pos);
+        // Setting bit 5 maps upper case letters to lower case and nothing else into a-z
+        const auto lower = _mm_or_si128(block, _mm_set1_epi8(0x20));
+        const unsigned identifier = simd::rangeMask(lower, 'a', 'z') |
+                                    simd::rangeMask(block, '0', '9') |
+                                    simd::equalMask(block, '_');
+        if (identifier != simd::FULL_MASK) {
+            return pos + static_cast<unsigned>(std::countr_one(identifier));
+        }
+        pos += simd::BLOCK_SIZE;
+    }
+#endif
+
+    while (pos < text.size() && isIdentifierChar(text[pos])) { ++pos; }
+    return pos;
+}
+
+/**
+ * Find end of a line
+ * @param text source text
+ * @param pos position to start at
+ * @return position of the next newline, size of the text if there is none
+ */
+inline std::size_t findNewline(std::string_view text, std::size_t pos) {
+#if defined(__SSE2__)
+    while (pos + simd::BLOCK_SIZE <= text.size()) {
+        const unsigned newlines = simd::equalMask(simd::load(text, pos), '\n');
+        if (newlines) {
+            return pos + static_cast<unsigned>(std::countr_zero(newlines));
+        }
+        pos += simd::BLOCK_SIZE;
+    }
+#endif
+
+    while (pos < text.size() && text[pos] != '\n') { ++pos; }
+    return pos;
+}
+
+/**
+ * Find the closing quote of a string literal
+ * @param text source text
+ * @param pos position after the opening quote
+ * @param line line counter, incremented for every newline before the quote
+ * @return position of the quote, size of the text if there is none
+ */
+inline std::size_t findQuote(std::string_view text, std::size_t pos, int& line) {
+#if defined(__SSE2__)
+    while (pos + simd::BLOCK_SIZE <= text.size()) {
+        const auto block = simd::load(text, pos);
+        const unsigned newlines = simd::equalMask(block, '\n');
+        const unsigned quotes = simd::equalMask(block, '"');
+        if (quotes) {
+            const auto index = static_cast<unsigned>(std::countr_zero(quotes));
+            line += std::popcount(newlines & simd::bitsBelow(index));
+            return pos + index;
+        }
+        line += std::popcount(newlines);
+        pos += simd::BLOCK_SIZE;
+    }
+#endif
+
+    for (; pos < text.size() && text[pos] != '"'; ++pos) {
+        if (text[pos] == '\n') { ++line; }
+    }
+    return pos;
+}
+
+/**
+ * Find next character that may open or close a multi-line comment
+ * @param text source text
+ * @param pos position to start at
+ * @return position of the next '*' or '/', size of the text if there is none
+ */
+inline std::size_t findCommentDelimiter(std::string_view text, std::size_t pos) {
+#if defined(__SSE2__)
+    while (pos + simd::BLOCK_SIZE <= text.size()) {
+        const auto block = simd::load(text, pos);
+        const unsigned delimiters = simd::equalMask(block, '*') | simd::equalMask(block, '/');
+        if (delimiters) {
+            return pos + static_cast<unsigned>(std::countr_zero(delimiters));
+        }
+        pos += simd::BLOCK_SIZE;
+    }
+#endif
+
+    while (pos < text.size() && text[pos] != '*' && text[pos] != '/') { ++pos; }
+    return pos;
+}
+
+
+#endif //LOX_CHAR_SCAN_H
@@ -0,0 +1,16 @@
+#include "chunk.h"
+
+std::uint32_t Chunk::addConstant(LoxType value) {
+    constants.push_back(std::move(value));
+    return static_cast<std::uint32_t>(constants.size() - 1);
+}
+
+std::uint32_t Chunk::addToken(const Token& token) {
+    tokens.push_back(token);
+    return static_cast<std::uint32_t>(tokens.size() - 1);
+}
+
+std::uint32_t Chunk::addCache(PropertyCache& cache) {
+    caches.push_back(&cache);
+    return static_cast<std::uint32_t>(caches.size() - 1);
+}
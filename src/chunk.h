@@ -0,0 +1,158 @@
+#ifndef LOX_CHUNK_H
+#define LOX_CHUNK_H
+
+#include "token.h"
+#include "types.h"
+#include "inline_cache.h"
+#include "expressions.h"
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+/*!
+ * Instructions of the bytecode VM. Operands follow the opcode inline,
+ * their widths are listed next to each instruction.
+ * "slot" is the register of a local assigned by the resolver, registers
+ * of a call are stack slots starting at the frame's base. Captured locals
+ * hold an upvalue cell in their register.
+ */
+enum class OpCode : std::uint8_t {
+    CONSTANT,           // u32 constant index
+    NIL,
+    TRUE,
+    FALSE,
+    POP,
+
+    GET_LOCAL,          // u16 slot
+    SET_LOCAL,          // u16 slot
+    DEFINE_LOCAL,       // u16 slot, pops value into the register
+    GET_CAPTURED,       // u16 slot
+    SET_CAPTURED,       // u16 slot
+    DEFINE_CAPTURED,    // u16 slot, pops value into a new upvalue cell
+    GET_UPVALUE,        // u16 upvalue index of the running closure
+    SET_UPVALUE,        // u16 upvalue index of the running closure
+    GET_GLOBAL,         // u32 slot
+    SET_GLOBAL,         // u32 slot
+    DEFINE_GLOBAL,      // pops value and defines it as the next global
+
+    GET_PROPERTY,       // u32 token index, u32 cache index
+    SET_PROPERTY,       // u32 token index, u32 cache index
+    GET_SUPER,          // u32 token index, u32 cache index; pops superclass and receiver
+
+    EQUAL,
+    NOT_EQUAL,
+    GREATER,            // u32 token index, for all arithmetic and comparison operators
+    GREATER_EQUAL,
+    LESS,
+    LESS_EQUAL,
+    ADD,
+    SUBTRACT,
+    MULTIPLY,
+    DIVIDE,
+    NOT,
+    NEGATE,             // u32 token index
+
+    PRINT,
+
+    JUMP,               // i32 offset relative to the end of the instruction
+    JUMP_IF_FALSE,      // i32 offset, leaves condition on the stack
+    JUMP_IF_TRUE,       // i32 offset, leaves condition on the stack
+    POP_JUMP_IF_FALSE,  // i32 offset, pops condition
+
+    CALL,               // u8 argument count, u32 token index
+    INVOKE,             // u8 argument count, u32 name token, u32 paren token, u32 cache index;
+                        // calls a property of the receiver below the arguments
+    CLOSURE,            // u32 function index
+    CLASS,              // u32 class index; pops the superclass if there is one, pushes the class
+    RETURN
+};
+
+struct Chunk;
+
+/**
+ * Compiled form of a function body, shared between all closures
+ * created from the same declaration
+ */
+struct FunctionCode {
+    std::string name;
+    int arity = 0;
+    std::shared_ptr<Chunk> chunk;
+    std::size_t slotCount = 0;                   // Registers of a call, including this and the parameters
+    std::vector<std::size_t> capturedParameters; // Registers of this and parameters promoted to cells on entry
+    std::vector<UpvalueDescriptor> upvalues;
+};
+
+/**
+ * Compiled form of a class declaration
+ */
+struct ClassCode {
+    Token name;
+    std::vector<std::shared_ptr<FunctionCode>> methods;
+    std::optional<Token> superclass; // Name of the superclass, if any
+    VariableLocation superLocation;  // Register of super, set before the methods capture it
+};
+
+/**
+ * A sequence of bytecode instructions together with the tables
+ * its operands refer to
+ */
+struct Chunk {
+    std::vector<std::uint8_t> code;
+    std::vector<LoxType> constants;
+    std::vector<Token> tokens; // Tokens for error reporting and property names
+    std::vector<std::shared_ptr<FunctionCode>> functions;
+    std::vector<std::shared_ptr<ClassCode>> classes;
+    std::vector<PropertyCache*> caches; // Inline caches of the AST nodes the code was compiled from
+
+    /**
+     * Append opcode
+     * @param op instruction to append
+     */
+    void write(OpCode op) {
+        code.push_back(static_cast<std::uint8_t>(op));
+    }
+
+    /**
+     * Append an operand of fixed width
+     * @param operand operand value, stored in native byte order
+     */
+    template<typename T>
+    void writeOperand(T operand) {
+        const auto offset = code.size();
+        code.resize(offset + sizeof(T));
+        std::memcpy(code.data() + offset, &operand, sizeof(T));
+    }
+
+    /**
+     * Overwrite an operand that was emitted earlier, used for jump patching
+     * @param offset byte offset of the operand
+     * @param operand new value
+     */
+    template<typename T>
+    void patchOperand(std::size_t offset, T operand) {
+        std::memcpy(code.data() + offset, &operand, sizeof(T));
+    }
+
+    std::uint32_t addConstant(LoxType value);
+    std::uint32_t addToken(const Token& token);
+    std::uint32_t addCache(PropertyCache& cache);
+};
+
+/**
+ * Read operand of fixed width and advance instruction pointer
+ * @param ip instruction pointer
+ * @return operand value
+ */
+template<typename T>
+inline T readOperand(const std::uint8_t*& ip) {
+    T value;
+    std::memcpy(&value, ip, sizeof(T));
+    ip += sizeof(T);
+    return value;
+}
+
+#endif //LOX_CHUNK_H
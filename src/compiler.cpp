@@ -0,0 +1,358 @@
+#include "compiler.h"
+
+std::shared_ptr<Chunk> Compiler::compile(std::vector<AstPtr<Statement>>& program) {
+    functions_.push_back(FunctionState{std::make_shared<Chunk>(), {}});
+
+    for (const auto& statement : program) {
+        statement->accept(*this);
+    }
+    emit(OpCode::NIL);
+    emit(OpCode::RETURN);
+
+    auto script = functions_.back().chunk;
+    functions_.pop_back();
+    return script;
+}
+
+std::shared_ptr<FunctionCode> Compiler::compileFunction(std::string_view name, const FunctionPrototype& prototype) {
+    auto code = std::make_shared<FunctionCode>();
+    code->name = name;
+    code->arity = static_cast<int>(prototype.params.size());
+    code->chunk = std::make_shared<Chunk>();
+    code->slotCount = prototype.slotCount;
+    code->capturedParameters = prototype.capturedParameters;
+    code->upvalues = prototype.upvalues;
+
+    functions_.push_back(FunctionState{code->chunk, {}});
+    for (const auto& statement : prototype.body) {
+        statement->accept(*this);
+    }
+    emit(OpCode::NIL);
+    emit(OpCode::RETURN);
+    functions_.pop_back();
+
+    return code;
+}
+
+void Compiler::visitBinary(Binary& b) {
+    b.getLeft()->accept(*this);
+    b.getRight()->accept(*this);
+
+    const Token& op = b.getOperator();
+    switch (op.getType()) {
+        case TokenType::MINUS: emitWithToken(OpCode::SUBTRACT, op); break;
+        case TokenType::SLASH: emitWithToken(OpCode::DIVIDE, op); break;
+        case TokenType::STAR: emitWithToken(OpCode::MULTIPLY, op); break;
+        case TokenType::PLUS: emitWithToken(OpCode::ADD, op); break;
+        case TokenType::GREATER: emitWithToken(OpCode::GREATER, op); break;
+        case TokenType::GREATER_EQUAL: emitWithToken(OpCode::GREATER_EQUAL, op); break;
+        case TokenType::LESS: emitWithToken(OpCode::LESS, op); break;
+        case TokenType::LESS_EQUAL: emitWithToken(OpCode::LESS_EQUAL, op); break;
+        case TokenType::BANG_EQUAL: emit(OpCode::NOT_EQUAL); break;
+        case TokenType::EQUAL_EQUAL: emit(OpCode::EQUAL); break;
+        case TokenType::COMMA:
+            // Value of a comma expression is the left operand
+            emit(OpCode::POP);
+            break;
+        default:
+            throw std::runtime_error("This should never happen.");
+    }
+}
+
+void Compiler::visitTernary(Ternary& t) {
+    t.getLeft()->accept(*this);
+    auto else_jump = emitJump(OpCode::POP_JUMP_IF_FALSE);
+    t.getMiddle()->accept(*this);
+    auto end_jump = emitJump(OpCode::JUMP);
+    patchJump(else_jump);
+    t.getRight()->accept(*this);
+    patchJump(end_jump);
+}
+
+void Compiler::visitGrouping(Grouping& g) {
+    g.getExpression()->accept(*this);
+}
+
+void Compiler::visitLiteral(Literal& l) {
+    const LoxType& value = l.getValue();
+    if (value.isNil()) {
+        emit(OpCode::NIL);
+    } else if (value.isBool()) {
+        emit(value.asBool() ? OpCode::TRUE : OpCode::FALSE);
+    } else {
+        emit(OpCode::CONSTANT);
+        chunk().writeOperand<std::uint32_t>(chunk().addConstant(value));
+    }
+}
+
+void Compiler::visitUnary(Unary& u) {
+    u.getRight()->accept(*this);
+
+    switch (u.getOperator().getType()) {
+        case TokenType::BANG: emit(OpCode::NOT); break;
+        case TokenType::MINUS: emitWithToken(OpCode::NEGATE, u.getOperator()); break;
+        default:
+            throw std::runtime_error("This should never happen.");
+    }
+}
+
+void Compiler::visitVariableAccess(VariableAccess& v) {
+    emitGet(v.getLocation());
+}
+
+void Compiler::visitAssignment(Assignment& a) {
+    a.getValue()->accept(*this);
+    emitSet(a.getLocation());
+}
+
+void Compiler::visitLogical(Logical& l) {
+    l.getLeft()->accept(*this);
+
+    // Short-circuit: keep the left value if it decides the result
+    auto end_jump = emitJump(l.getOperator().getType() == TokenType::OR ?
+                             OpCode::JUMP_IF_TRUE : OpCode::JUMP_IF_FALSE);
+    emit(OpCode::POP);
+    l.getRight()->accept(*this);
+    patchJump(end_jump);
+}
+
+void Compiler::visitCall(Call& c) {
+    if (auto* property = c.getInvokedProperty()) {
+        property->getObject()->accept(*this);
+        for (const auto& argument : c.getArguments()) {
+            argument->accept(*this);
+        }
+
+        emit(OpCode::INVOKE);
+        chunk().writeOperand<std::uint8_t>(static_cast<std::uint8_t>(c.getArguments().size()));
+        chunk().writeOperand<std::uint32_t>(chunk().addToken(property->getName()));
+        chunk().writeOperand<std::uint32_t>(chunk().addToken(c.getParen()));
+        chunk().writeOperand<std::uint32_t>(chunk().addCache(property->getCache()));
+        return;
+    }
+
+    c.getCallee()->accept(*this);
+    for (const auto& argument : c.getArguments()) {
+        argument->accept(*this);
+    }
+
+    emit(OpCode::CALL);
+    chunk().writeOperand<std::uint8_t>(static_cast<std::uint8_t>(c.getArguments().size()));
+    chunk().writeOperand<std::uint32_t>(chunk().addToken(c.getParen()));
+}
+
+void Compiler::visitFunctionExpression(FunctionExpression& f) {
+    auto code = compileFunction("", f.getPrototype());
+    chunk().functions.push_back(std::move(code));
+
+    emit(OpCode::CLOSURE);
+    chunk().writeOperand<std::uint32_t>(static_cast<std::uint32_t>(chunk().functions.size() - 1));
+}
+
+void Compiler::visitGetExpression(GetExpression& g) {
+    g.getObject()->accept(*this);
+    emitWithToken(OpCode::GET_PROPERTY, g.getName());
+    chunk().writeOperand<std::uint32_t>(chunk().addCache(g.getCache()));
+}
+
+void Compiler::visitSetExpression(SetExpression& s) {
+    s.getObject()->accept(*this);
+    s.getValue()->accept(*this);
+    emitWithToken(OpCode::SET_PROPERTY, s.getName());
+    chunk().writeOperand<std::uint32_t>(chunk().addCache(s.getCache()));
+}
+
+void Compiler::visitThisExpression(ThisExpression& t) {
+    emitGet(t.getLocation());
+}
+
+void Compiler::visitSuperExpression(SuperExpression& s) {
+    emitGet(s.getThisLocation());
+    emitGet(s.getLocation());
+    emitWithToken(OpCode::GET_SUPER, s.getMethod());
+    chunk().writeOperand<std::uint32_t>(chunk().addCache(s.getCache()));
+}
+
+void Compiler::visitExpressionStatement(ExpressionStatement& s) {
+    s.getExpression()->accept(*this);
+    emit(OpCode::POP);
+}
+
+void Compiler::visitPrintStatement(PrintStatement& p) {
+    p.getExpression()->accept(*this);
+    emit(OpCode::PRINT);
+}
+
+void Compiler::visitVariableDeclaration(VariableDeclaration& v) {
+    if (v.getExpression()) {
+        v.getExpression()->accept(*this);
+    } else {
+        emit(OpCode::NIL);
+    }
+    emitDefine(v.getLocation());
+}
+
+void Compiler::visitBlock(Block& b) {
+    // Locals of the block already have their registers, entering it costs nothing
+    for (const auto& statement : b.getStatements()) {
+        statement->accept(*this);
+    }
+}
+
+void Compiler::visitIfStatement(IfStatement& i) {
+    i.getCondition()->accept(*this);
+    auto else_jump = emitJump(OpCode::POP_JUMP_IF_FALSE);
+    i.getThenBranch()->accept(*this);
+
+    if (i.getElseBranch()) {
+        auto end_jump = emitJump(OpCode::JUMP);
+        patchJump(else_jump);
+        i.getElseBranch()->accept(*this);
+        patchJump(end_jump);
+    } else {
+        patchJump(else_jump);
+    }
+}
+
+void Compiler::visitWhileStatement(WhileStatement& w) {
+    auto loop_start = chunk().code.size();
+    w.getCondition()->accept(*this);
+    auto exit_jump = emitJump(OpCode::POP_JUMP_IF_FALSE);
+
+    functions_.back().loops.push_back(Loop{});
+    w.getThenBranch()->accept(*this);
+    emitJumpBack(loop_start);
+
+    patchJump(exit_jump);
+    for (auto jump : functions_.back().loops.back().breakJumps) {
+        patchJump(jump);
+    }
+    functions_.back().loops.pop_back();
+}
+
+void Compiler::visitBreakStatement(BreakStatement&) {
+    // The parser only allows break within a loop of the same function.
+    // Locals live in registers, leaving their blocks needs no cleanup
+    functions_.back().loops.back().breakJumps.push_back(emitJump(OpCode::JUMP));
+}
+
+void Compiler::visitFunction(Function& f) {
+    auto code = compileFunction(f.getName().getLexeme(), f.getPrototype());
+    chunk().functions.push_back(std::move(code));
+
+    const auto& location = f.getLocation();
+    if (location.captured) {
+        // A local function calling itself captures its own cell, which has to exist first
+        emit(OpCode::NIL);
+        emitDefine(location);
+    }
+
+    emit(OpCode::CLOSURE);
+    chunk().writeOperand<std::uint32_t>(static_cast<std::uint32_t>(chunk().functions.size() - 1));
+    if (location.captured) {
+        emitSet(location);
+        emit(OpCode::POP);
+    } else {
+        emitDefine(location);
+    }
+}
+
+void Compiler::visitReturn(Return& r) {
+    if (r.getValue()) {
+        r.getValue()->accept(*this);
+    } else {
+        emit(OpCode::NIL);
+    }
+    emit(OpCode::RETURN);
+}
+
+void Compiler::visitClassDeclaration(ClassDeclaration& c) {
+    auto code = std::make_shared<ClassCode>(ClassCode{c.getName(), {}, {}, c.getSuperLocation()});
+
+    // Methods may capture the class variable, so it is defined before the class exists
+    emit(OpCode::NIL);
+    emitDefine(c.getLocation());
+
+    if (c.getSuperclass()) {
+        c.getSuperclass()->accept(*this);
+        code->superclass.emplace(c.getSuperclass()->getToken());
+    }
+
+    for (const auto& method : c.getMethods()) {
+        code->methods.push_back(compileFunction(method->getName().getLexeme(), method->getPrototype()));
+    }
+
+    chunk().classes.push_back(std::move(code));
+    emit(OpCode::CLASS);
+    chunk().writeOperand<std::uint32_t>(static_cast<std::uint32_t>(chunk().classes.size() - 1));
+    emitSet(c.getLocation());
+    emit(OpCode::POP);
+}
+
+Chunk& Compiler::chunk() {
+    return *functions_.back().chunk;
+}
+
+void Compiler::emit(OpCode op) {
+    chunk().write(op);
+}
+
+void Compiler::emitWithToken(OpCode op, const Token& token) {
+    chunk().write(op);
+    chunk().writeOperand<std::uint32_t>(chunk().addToken(token));
+}
+
+void Compiler::emitGet(const VariableLocation& location) {
+    emitVariable(location, OpCode::GET_GLOBAL, OpCode::GET_LOCAL, OpCode::GET_CAPTURED, OpCode::GET_UPVALUE);
+}
+
+void Compiler::emitSet(const VariableLocation& location) {
+    emitVariable(location, OpCode::SET_GLOBAL, OpCode::SET_LOCAL, OpCode::SET_CAPTURED, OpCode::SET_UPVALUE);
+}
+
+void Compiler::emitDefine(const VariableLocation& location) {
+    if (location.isGlobal()) {
+        // Globals are defined in declaration order, the index is implied
+        emit(OpCode::DEFINE_GLOBAL);
+        return;
+    }
+    emit(location.captured ? OpCode::DEFINE_CAPTURED : OpCode::DEFINE_LOCAL);
+    // The resolver rejects functions with more than Resolver::MAX_SLOT registers or upvalues
+    chunk().writeOperand<std::uint16_t>(static_cast<std::uint16_t>(location.index));
+}
+
+void Compiler::emitVariable(const VariableLocation& location, OpCode global_op, OpCode local_op,
+                            OpCode captured_op, OpCode upvalue_op) {
+    switch (location.kind) {
+        case VariableLocation::Kind::GLOBAL:
+            emit(global_op);
+            chunk().writeOperand<std::uint32_t>(static_cast<std::uint32_t>(location.index));
+            break;
+        case VariableLocation::Kind::LOCAL:
+            emit(location.captured ? captured_op : local_op);
+            chunk().writeOperand<std::uint16_t>(static_cast<std::uint16_t>(location.index));
+            break;
+        case VariableLocation::Kind::UPVALUE:
+            emit(upvalue_op);
+            chunk().writeOperand<std::uint16_t>(static_cast<std::uint16_t>(location.index));
+            break;
+    }
+}
+
+std::size_t Compiler::emitJump(OpCode op) {
+    emit(op);
+    auto operand_offset = chunk().code.size();
+    chunk().writeOperand<std::int32_t>(0);
+    return operand_offset;
+}
+
+void Compiler::patchJump(std::size_t operand_offset) {
+    auto distance = chunk().code.size() - (operand_offset + sizeof(std::int32_t));
+    chunk().patchOperand<std::int32_t>(operand_offset, static_cast<std::int32_t>(distance));
+}
+
+void Compiler::emitJumpBack(std::size_t target) {
+    emit(OpCode::JUMP);
+    auto end = static_cast<std::int64_t>(chunk().code.size() + sizeof(std::int32_t));
+    chunk().writeOperand<std::int32_t>(static_cast<std::int32_t>(static_cast<std::int64_t>(target) - end));
+}
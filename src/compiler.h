@@ -0,0 +1,88 @@
+#ifndef LOX_COMPILER_H
+#define LOX_COMPILER_H
+
+#include "chunk.h"
+#include "expressions.h"
+#include "statements.h"
+
+#include <memory>
+#include <string_view>
+#include <vector>
+
+/**
+ * Compiles a resolved AST into bytecode for the VM.
+ * Variable locations are taken from the resolve pass, so
+ * the resolver has to run before the compiler.
+ */
+class Compiler : public ExpressionVisitor, public StatementVisitor {
+public:
+    /**
+     * Compile top-level program
+     * @param program sequence of statements
+     * @return chunk to be run by the VM
+     */
+    std::shared_ptr<Chunk> compile(std::vector<AstPtr<Statement>>& program);
+
+    ~Compiler() override = default;
+
+private:
+    /**
+     * Bookkeeping for enclosing loops, needed to compile break statements
+     */
+    struct Loop {
+        std::vector<std::size_t> breakJumps;
+    };
+
+    /**
+     * Compilation state of the function currently being compiled
+     */
+    struct FunctionState {
+        std::shared_ptr<Chunk> chunk;
+        std::vector<Loop> loops;
+    };
+
+    std::vector<FunctionState> functions_;
+
+    void visitBinary(Binary &b) override;
+    void visitTernary(Ternary &t) override;
+    void visitGrouping(Grouping &g) override;
+    void visitLiteral(Literal &l) override;
+    void visitUnary(Unary &u) override;
+    void visitVariableAccess(VariableAccess& v) override;
+    void visitAssignment(Assignment& a) override;
+    void visitLogical(Logical& l) override;
+    void visitCall(Call& c) override;
+    void visitFunctionExpression(FunctionExpression& f) override;
+    void visitGetExpression(GetExpression& g) override;
+    void visitSetExpression(SetExpression& s) override;
+    void visitThisExpression(ThisExpression& t) override;
+    void visitSuperExpression(SuperExpression& s) override;
+
+    void visitExpressionStatement(ExpressionStatement& s) override;
+    void visitPrintStatement(PrintStatement& p) override;
+    void visitVariableDeclaration(VariableDeclaration& v) override;
+    void visitBlock(Block& b) override;
+    void visitIfStatement(IfStatement& i) override;
+    void visitWhileStatement(WhileStatement& w) override;
+    void visitBreakStatement(BreakStatement& b) override;
+    void visitFunction(Function& f) override;
+    void visitReturn(Return& r) override;
+    void visitClassDeclaration(ClassDeclaration& c) override;
+
+    std::shared_ptr<FunctionCode> compileFunction(std::string_view name, const FunctionPrototype& prototype);
+
+    Chunk& chunk();
+    void emit(OpCode op);
+    void emitWithToken(OpCode op, const Token& token);
+    void emitGet(const VariableLocation& location);
+    void emitSet(const VariableLocation& location);
+    void emitDefine(const VariableLocation& location);
+    void emitVariable(const VariableLocation& location, OpCode global_op, OpCode local_op,
+                      OpCode captured_op, OpCode upvalue_op);
+    std::size_t emitJump(OpCode op);
+    void patchJump(std::size_t operand_offset);
+    void emitJumpBack(std::size_t target);
+};
+
+
+#endif //LOX_COMPILER_H
@@ -6,6 +6,9 @@
 
 #include "interpreter.h"
 
+Environment::Environment() : Obj(ObjType::ENVIRONMENT)
+{}
+
 std::size_t Environment::define() {
     values_.emplace_back(NullType{});
     return values_.size() - 1;
@@ -21,45 +24,20 @@ const LoxType& Environment::get(std::size_t index) {
         return values_[index];
     }
 
-    if (enclosing_) { return enclosing_->get(index); }
-
     throw std::runtime_error("This should never happen.");
 }
 
-const LoxType& Environment::getAt(std::size_t index, int distance) {
-    return ancestor(distance)->get(index);
-}
-
 void Environment::assign(std::size_t index, LoxType value) {
     if (index < values_.size()) {
         values_[index] = std::move(value);
         return;
     }
 
-    if (enclosing_) {
-        enclosing_->assign(index, value);
-        return;
-    }
-
     throw std::runtime_error("This should never happen.");
 }
 
-void Environment::assignAt(std::size_t index, LoxType value, int distance) {
-    ancestor(distance)->assign(index, std::move(value));
-}
-
-void Environment::setEnclosing(std::shared_ptr<Environment> enclosing) {
-    enclosing_ = std::move(enclosing);
-}
-
-Environment* Environment::ancestor(int distance) {
-    Environment* environment = this;
-    for (int i = 0; i < distance; ++i) {
-        environment = environment->enclosing_.get();
+void Environment::trace(Heap& heap) {
+    for (const auto& value : values_) {
+        heap.markValue(value);
     }
-
-    return environment;
 }
-
-
-
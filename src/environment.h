@@ -6,16 +6,22 @@
 #define LOX_ENVIRONMENT_H
 
 #include "types.h"
+#include "heap.h"
 
 #include <string>
 #include <iostream>
 
 /*!
  * This represents an environment in Lox,
- * which stores values of variables
+ * which stores values of variables.
+ * Only globals live in an environment, locals are kept in the
+ * registers of their call and in upvalue cells once captured.
+ * Environments live on the garbage collected heap
  */
-class Environment {
+class Environment : public Obj {
 public:
+    Environment();
+
     /**
      * Define new null-initialized variable
      * @return variable index for later lookup
@@ -36,14 +42,6 @@ public:
      */
     const LoxType& get(std::size_t index);
 
-    /**
-     * Get variable at specific depth
-     * @param index index of variable in array
-     * @param distance distance from current environment
-     * @return reference to value of variable
-     */
-    const LoxType& getAt(std::size_t index, int distance);
-
     /*!
      * Re-assign variable
      * @param index index of variable in array
@@ -51,28 +49,8 @@ public:
      */
     void assign(std::size_t index, LoxType value);
 
-    /**
-     * Re-assign variable value
-     * @param index index of variable in array
-     * @param value new value
-     * @param distance distance from current environment
-     */
-    void assignAt(std::size_t index, LoxType value, int distance);
-
-    /*!
-     * Set enclosing scope
-     * @param enclosing handle to enclosing scope
-     */
-    void setEnclosing(std::shared_ptr<Environment> enclosing);
-
-    /**
-     * Get ancestor of environment, i.e. enclosing scope
-     * @param distance distance of scope from current environment
-     * @return reference to environment
-     */
-    Environment* ancestor(int distance);
+    void trace(Heap& heap) override;
 private:
-    std::shared_ptr<Environment> enclosing_; // Represents upper-level scope
     std::vector<LoxType> values_; // Represents value array
 };
 
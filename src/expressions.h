@@ -5,10 +5,13 @@
 #ifndef LOX_EXPRESSIONS_H
 #define LOX_EXPRESSIONS_H
 
+#include <cstdint>
 #include <utility>
 #include <vector>
+#include <ast_arena.h>
 #include <token.h>
 #include <types.h>
+#include <inline_cache.h>
 
 class Binary;
 class Ternary;
@@ -27,6 +30,35 @@ class SuperExpression;
 
 class Statement;
 
+/*!
+ * Location of a variable, filled in by the resolve pass.
+ * Locals live in the registers of the call that declares them. Locals that
+ * are captured by a closure are promoted to upvalue cells and their register
+ * holds the cell, closures reach them through their own upvalue list
+ */
+struct VariableLocation {
+    enum class Kind : std::uint8_t {
+        GLOBAL,  // Index into the globals
+        LOCAL,   // Register of the current call
+        UPVALUE  // Upvalue of the current closure
+    };
+
+    Kind kind = Kind::GLOBAL;
+    bool captured = false; // Locals only: the register holds an upvalue cell
+    std::size_t index = 0;
+
+    [[nodiscard]] bool isGlobal() const { return kind == Kind::GLOBAL; }
+};
+
+/*!
+ * Where a closure takes one of its upvalues from when it is created:
+ * a register of the enclosing call or an upvalue of the enclosing closure
+ */
+struct UpvalueDescriptor {
+    bool local = true;
+    std::size_t index = 0;
+};
+
 /*!
  * AST visitor interface
  */
@@ -58,6 +90,7 @@ public:
     virtual ~Expression() = default;
     virtual void accept (ExpressionVisitor& visitor) = 0;
     [[nodiscard]] virtual bool lvalue() const { return false; }
+    [[nodiscard]] virtual GetExpression* asGetExpression() { return nullptr; }
 };
 
 /*!
@@ -65,7 +98,7 @@ public:
  */
 class Binary : public Expression {
 public:
-    Binary(std::unique_ptr<Expression> left, Token  op, std::unique_ptr<Expression> right)
+    Binary(AstPtr<Expression> left, Token  op, AstPtr<Expression> right)
             : left_(std::move(left)), operator_(std::move(op)), right_(std::move(right)) {}
 
     ~Binary() override = default;
@@ -74,7 +107,7 @@ public:
         visitor.visitBinary(*this);
     }
 
-    [[nodiscard]] const std::unique_ptr<Expression>& getLeft() const {
+    [[nodiscard]] const AstPtr<Expression>& getLeft() const {
         return left_;
     }
 
@@ -82,14 +115,14 @@ public:
         return operator_;
     }
 
-    [[nodiscard]] const std::unique_ptr<Expression>& getRight() const {
+    [[nodiscard]] const AstPtr<Expression>& getRight() const {
         return right_;
     }
 
 private:
-    std::unique_ptr<Expression> left_;
+    AstPtr<Expression> left_;
     Token operator_;
-    std::unique_ptr<Expression> right_;
+    AstPtr<Expression> right_;
 };
 
 /*!
@@ -97,7 +130,7 @@ private:
  */
 class Ternary : public Expression {
 public:
-    Ternary(std::unique_ptr<Expression> left, std::unique_ptr<Expression> middle, std::unique_ptr<Expression> right)
+    Ternary(AstPtr<Expression> left, AstPtr<Expression> middle, AstPtr<Expression> right)
         : left_(std::move(left)), middle_(std::move(middle)), right_(std::move(right)) {}
 
     ~Ternary() override = default;
@@ -106,22 +139,22 @@ public:
         visitor.visitTernary(*this);
     }
 
-    [[nodiscard]] const std::unique_ptr<Expression>& getLeft() const {
+    [[nodiscard]] const AstPtr<Expression>& getLeft() const {
         return left_;
     }
 
-    [[nodiscard]] const std::unique_ptr<Expression>& getMiddle() const {
+    [[nodiscard]] const AstPtr<Expression>& getMiddle() const {
         return middle_;
     }
 
-    [[nodiscard]] const std::unique_ptr<Expression>& getRight() const {
+    [[nodiscard]] const AstPtr<Expression>& getRight() const {
         return right_;
     }
 
 private:
-    std::unique_ptr<Expression> left_;
-    std::unique_ptr<Expression> middle_;
-    std::unique_ptr<Expression> right_;
+    AstPtr<Expression> left_;
+    AstPtr<Expression> middle_;
+    AstPtr<Expression> right_;
 };
 
 /*!
@@ -129,7 +162,7 @@ private:
  */
 class Grouping : public Expression {
 public:
-    explicit Grouping(std::unique_ptr<Expression> expression) : expression_(std::move(expression)) {}
+    explicit Grouping(AstPtr<Expression> expression) : expression_(std::move(expression)) {}
 
     ~Grouping() override = default;
 
@@ -137,11 +170,11 @@ public:
         visitor.visitGrouping(*this);
     }
 
-    [[nodiscard]] const std::unique_ptr<Expression>& getExpression() const {
+    [[nodiscard]] const AstPtr<Expression>& getExpression() const {
         return expression_;
     }
 private:
-    std::unique_ptr<Expression> expression_;
+    AstPtr<Expression> expression_;
 };
 
 /*!
@@ -151,7 +184,8 @@ class Literal : public Expression {
 public:
     explicit Literal() : value_(NullType{}) {}
     explicit Literal(double value) : value_(value) {}
-    explicit Literal(const std::string& value) : value_(value) {}
+    // String literals are interned and kept alive by the scanner
+    explicit Literal(LoxString* value) : value_(value) {}
     explicit Literal(bool value) : value_(value) {}
 
     ~Literal() override = default;
@@ -172,7 +206,7 @@ private:
  */
 class Unary : public Expression {
 public:
-    Unary(Token op, std::unique_ptr<Expression> right) : operator_(std::move(op)), right_(std::move(right)) {}
+    Unary(Token op, AstPtr<Expression> right) : operator_(std::move(op)), right_(std::move(right)) {}
 
     ~Unary() override = default;
 
@@ -184,12 +218,12 @@ public:
         return operator_;
     }
 
-    [[nodiscard]] const std::unique_ptr<Expression>& getRight() const {
+    [[nodiscard]] const AstPtr<Expression>& getRight() const {
         return right_;
     }
 private:
     Token operator_;
-    std::unique_ptr<Expression> right_;
+    AstPtr<Expression> right_;
 };
 
 /*!
@@ -213,8 +247,13 @@ public:
         return true;
     }
 
+    [[nodiscard]] VariableLocation& getLocation() {
+        return location_;
+    }
+
 private:
     Token name_;
+    VariableLocation location_;
 };
 
 /*!
@@ -222,7 +261,7 @@ private:
  */
 class Assignment : public Expression {
 public:
-    Assignment(Token name, std::unique_ptr<Expression> expression)
+    Assignment(Token name, AstPtr<Expression> expression)
         : name_(std::move(name)), value_(std::move(expression)) {}
 
     ~Assignment() override = default;
@@ -235,13 +274,18 @@ public:
         return name_;
     }
 
-    [[nodiscard]] const std::unique_ptr<Expression>& getValue() const {
+    [[nodiscard]] const AstPtr<Expression>& getValue() const {
         return value_;
     }
 
+    [[nodiscard]] VariableLocation& getLocation() {
+        return location_;
+    }
+
 private:
     Token name_;
-    std::unique_ptr<Expression> value_;
+    AstPtr<Expression> value_;
+    VariableLocation location_;
 };
 
 /**
@@ -249,7 +293,7 @@ private:
  */
 class Logical : public Expression {
 public:
-    Logical(std::unique_ptr<Expression> left, Token token, std::unique_ptr<Expression> right)
+    Logical(AstPtr<Expression> left, Token token, AstPtr<Expression> right)
         : left_(std::move(left)), operator_(std::move(token)), right_(std::move(right)) {}
 
     ~Logical() override = default;
@@ -258,7 +302,7 @@ public:
         return visitor.visitLogical(*this);
     }
 
-    [[nodiscard]] const std::unique_ptr<Expression>& getLeft() const {
+    [[nodiscard]] const AstPtr<Expression>& getLeft() const {
         return left_;
     }
 
@@ -266,14 +310,14 @@ public:
         return operator_;
     }
 
-    [[nodiscard]] const std::unique_ptr<Expression>& getRight() const {
+    [[nodiscard]] const AstPtr<Expression>& getRight() const {
         return right_;
     }
 
 private:
-    std::unique_ptr<Expression> left_;
+    AstPtr<Expression> left_;
     Token operator_;
-    std::unique_ptr<Expression> right_;
+    AstPtr<Expression> right_;
 };
 
 /**
@@ -281,8 +325,9 @@ private:
  */
 class Call : public Expression {
 public:
-    Call(std::unique_ptr<Expression> callee, Token paren, std::vector<std::unique_ptr<Expression>>&& arguments)
-        : callee_(std::move(callee)), paren_(std::move(paren)), arguments_(std::move(arguments)) {}
+    Call(AstPtr<Expression> callee, Token paren, std::vector<AstPtr<Expression>>&& arguments)
+        : callee_(std::move(callee)), paren_(std::move(paren)), arguments_(std::move(arguments)),
+          property_(callee_->asGetExpression()) {}
 
     ~Call() override = default;
 
@@ -290,7 +335,7 @@ public:
         return visitor.visitCall(*this);
     }
 
-    [[nodiscard]] const std::unique_ptr<Expression> &getCallee() const {
+    [[nodiscard]] const AstPtr<Expression> &getCallee() const {
         return callee_;
     }
 
@@ -298,23 +343,48 @@ public:
         return paren_;
     }
 
-    [[nodiscard]] const std::vector<std::unique_ptr<Expression>> &getArguments() const {
+    [[nodiscard]] const std::vector<AstPtr<Expression>> &getArguments() const {
         return arguments_;
     }
 
+    /**
+     * Get property access if this is a call of the form object.name(...),
+     * which is invoked without creating a bound method first
+     * @return callee as property access, null for other callees
+     */
+    [[nodiscard]] GetExpression* getInvokedProperty() const {
+        return property_;
+    }
+
 private:
-    std::unique_ptr<Expression> callee_;
+    AstPtr<Expression> callee_;
     Token paren_;
-    std::vector<std::unique_ptr<Expression>> arguments_;
+    std::vector<AstPtr<Expression>> arguments_;
+    GetExpression* property_;
 };
 
 /**
  * Representation of lambda functions or anonymous functions
  */
+/*!
+ * Immutable part of a function declaration: parameters and body.
+ * It is owned by the AST node and shared by every closure created from the
+ * declaration, a closure only adds its captured upvalues
+ */
+struct FunctionPrototype {
+    std::vector<Token> params;
+    std::vector<AstPtr<Statement>> body;
+
+    // Filled in by the resolve pass
+    std::size_t slotCount = 0;                     // Registers of a call, including this and the parameters
+    std::vector<std::size_t> capturedParameters{}; // Registers of this and parameters promoted to cells on entry
+    std::vector<UpvalueDescriptor> upvalues{};
+};
+
 class FunctionExpression : public Expression {
 public:
-    FunctionExpression(std::vector<Token> arguments, std::vector<std::shared_ptr<Statement>>  statements)
-        : params_(std::move(arguments)), body_(std::move(statements)) {}
+    FunctionExpression(std::vector<Token> arguments, std::vector<AstPtr<Statement>>  statements)
+        : prototype_{std::move(arguments), std::move(statements)} {}
 
     ~FunctionExpression() override = default;
 
@@ -323,16 +393,19 @@ public:
     }
 
     [[nodiscard]] const std::vector<Token>& getParams() const {
-        return params_;
+        return prototype_.params;
     }
 
-    [[nodiscard]] std::vector<std::shared_ptr<Statement>>& getBody() {
-        return body_;
+    [[nodiscard]] std::vector<AstPtr<Statement>>& getBody() {
+        return prototype_.body;
+    }
+
+    [[nodiscard]] FunctionPrototype& getPrototype() {
+        return prototype_;
     }
 
 private:
-    std::vector<Token> params_;
-    std::vector<std::shared_ptr<Statement>> body_;
+    FunctionPrototype prototype_;
 };
 
 /**
@@ -340,10 +413,10 @@ private:
  */
 class GetExpression : public Expression {
 public:
-    GetExpression(std::unique_ptr<Expression> object, Token name)
+    GetExpression(AstPtr<Expression> object, Token name)
     : object_(std::move(object)), name(std::move(name)) {}
 
-    [[nodiscard]] std::unique_ptr<Expression>& getObject() {
+    [[nodiscard]] AstPtr<Expression>& getObject() {
         return object_;
     }
 
@@ -359,9 +432,18 @@ public:
         return true;
     }
 
+    [[nodiscard]] GetExpression* asGetExpression() override {
+        return this;
+    }
+
+    [[nodiscard]] PropertyCache& getCache() {
+        return cache_;
+    }
+
 private:
-    std::unique_ptr<Expression> object_;
+    AstPtr<Expression> object_;
     Token name;
+    PropertyCache cache_;
 };
 
 /**
@@ -369,14 +451,14 @@ private:
  */
  class SetExpression : public Expression {
  public:
-     SetExpression(std::unique_ptr<Expression> object, std::unique_ptr<Expression> value,
+     SetExpression(AstPtr<Expression> object, AstPtr<Expression> value,
                    Token name) : object_(std::move(object)), value_(std::move(value)), name_(std::move(name)) {}
 
-     [[nodiscard]] const std::unique_ptr<Expression>& getObject() const {
+     [[nodiscard]] const AstPtr<Expression>& getObject() const {
          return object_;
      }
 
-     [[nodiscard]] const std::unique_ptr<Expression>& getValue() const {
+     [[nodiscard]] const AstPtr<Expression>& getValue() const {
          return value_;
      }
 
@@ -388,10 +470,15 @@ private:
          visitor.visitSetExpression(*this);
      }
 
+     [[nodiscard]] PropertyCache& getCache() {
+         return cache_;
+     }
+
  private:
-     std::unique_ptr<Expression> object_;
-     std::unique_ptr<Expression> value_;
+     AstPtr<Expression> object_;
+     AstPtr<Expression> value_;
      Token name_;
+     PropertyCache cache_;
  };
 
  /**
@@ -408,8 +495,14 @@ public:
     void accept(ExpressionVisitor& visitor) override {
         visitor.visitThisExpression(*this);
     }
+
+    [[nodiscard]] VariableLocation& getLocation() {
+        return location_;
+    }
+
 private:
     Token keyword_;
+    VariableLocation location_;
 };
 
 class SuperExpression : public Expression {
@@ -428,9 +521,28 @@ public:
     void accept(ExpressionVisitor& visitor) override {
         visitor.visitSuperExpression(*this);
     }
+
+    [[nodiscard]] VariableLocation& getLocation() {
+        return location_;
+    }
+
+    /**
+     * Location of this in the method, the receiver of the super call
+     */
+    [[nodiscard]] VariableLocation& getThisLocation() {
+        return thisLocation_;
+    }
+
+    [[nodiscard]] PropertyCache& getCache() {
+        return cache_;
+    }
+
 private:
     Token keyword_;
     Token method_;
+    VariableLocation location_;
+    VariableLocation thisLocation_;
+    PropertyCache cache_; // Keyed by the root shape of the superclass
 };
 
 #endif //LOX_EXPRESSIONS_H
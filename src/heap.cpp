@@ -0,0 +1,141 @@
+#include "heap.h"
+
+#include <algorithm>
+#include <chrono>
+
+Heap::~Heap() {
+    while (objects_) {
+        Obj* next = objects_->next_;
+        free(objects_);
+        objects_ = next;
+    }
+}
+
+void Heap::collect(const std::function<void()>& mark_roots) {
+    auto start = std::chrono::steady_clock::now();
+
+    for (Obj* root : temporaryRoots_) {
+        markObject(root);
+    }
+    for (Obj* root : permanentObjects_) {
+        markObject(root);
+    }
+    mark_roots();
+    traceReferences();
+
+    // The string table does not keep strings alive
+    strings_.removeIf([](LoxString* string) { return !string->marked_; });
+    sweep();
+
+    nextCollection_ = std::max(threshold_,
+                               static_cast<std::size_t>(static_cast<double>(bytesAllocated_) * growthFactor_));
+
+    std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - start;
+    stats_.collectionMilliseconds += duration.count();
+    stats_.collections++;
+}
+
+LoxString* Heap::intern(std::string_view chars) {
+    const auto hash = LoxString::hashOf(chars);
+    if (auto* string = strings_.find(chars, hash)) { return string; }
+
+    auto* string = allocate<LoxString>(std::string{chars}, hash);
+    strings_.insert(string);
+    return string;
+}
+
+LoxString* Heap::intern(std::string&& chars) {
+    const auto hash = LoxString::hashOf(chars);
+    if (auto* string = strings_.find(chars, hash)) { return string; }
+
+    auto* string = allocate<LoxString>(std::move(chars), hash);
+    strings_.insert(string);
+    return string;
+}
+
+LoxString* Heap::internLiteral(std::string_view chars) {
+    std::lock_guard lock{literalMutex_};
+    auto* string = intern(chars);
+    makePermanent(string);
+    return string;
+}
+
+void Heap::makePermanent(Obj* object) {
+    // Literals are interned, the same string comes up for every occurrence and every rescan
+    if (object->permanent_) { return; }
+    object->permanent_ = true;
+    permanentObjects_.push_back(object);
+}
+
+void Heap::traceReferences() {
+    while (!grayObjects_.empty()) {
+        Obj* object = grayObjects_.back();
+        grayObjects_.pop_back();
+        object->trace(*this);
+    }
+}
+
+void Heap::sweep() {
+    Obj** link = &objects_;
+    while (*link) {
+        Obj* object = *link;
+        if (object->marked_) {
+            // Survivors are unmarked again for the next collection
+            object->marked_ = false;
+            link = &object->next_;
+            continue;
+        }
+
+        *link = object->next_;
+        bytesAllocated_ -= object->size_ + object->payload_;
+        stats_.freedObjects++;
+        stats_.freedBytes += object->size_ + object->payload_;
+        free(object);
+    }
+}
+
+void Heap::free(Obj* object) {
+    const auto size = object->size_;
+    object->~Obj();
+    pool_.release(object, size);
+}
+
+void Heap::setThreshold(std::size_t bytes) {
+    threshold_ = bytes;
+    nextCollection_ = bytes;
+}
+
+void Heap::setGrowthFactor(double factor) {
+    growthFactor_ = std::max(factor, 1.0);
+}
+
+const Heap::Stats& Heap::getStats() const {
+    return stats_;
+}
+
+const ObjectPool& Heap::getPool() const {
+    return pool_;
+}
+
+std::size_t Heap::getPermanentCount() const {
+    return permanentObjects_.size();
+}
+
+std::size_t Heap::getBytesAllocated() const {
+    return bytesAllocated_;
+}
+
+void Heap::printStats(std::ostream& os) const {
+    os << "[gc] collections: " << stats_.collections
+       << ", time: " << stats_.collectionMilliseconds << " ms\n";
+    os << "[gc] objects allocated: " << stats_.allocatedObjects
+       << ", freed: " << stats_.freedObjects
+       << ", live: " << stats_.allocatedObjects - stats_.freedObjects << '\n';
+    os << "[gc] bytes allocated: " << stats_.allocatedBytes
+       << ", freed: " << stats_.freedBytes
+       << ", live: " << bytesAllocated_
+       << ", peak: " << stats_.peakBytes << '\n';
+    os << "[gc] objects reusing pooled memory: " << pool_.getReused()
+       << ", system allocations: " << stats_.allocatedObjects - pool_.getReused()
+       << ", pooled bytes: " << pool_.getPooledBytes() << '\n';
+}
@@ -0,0 +1,242 @@
+#ifndef LOX_HEAP_H
+#define LOX_HEAP_H
+
+#include "types.h"
+#include "object_pool.h"
+#include "string_table.h"
+
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/*!
+ * Mark and sweep garbage collected heap owning all runtime objects:
+ * strings, functions, classes, instances, upvalue cells and the globals.
+ * Collections only happen when the owner of the heap calls collect
+ * at a point where every live object is reachable from its roots.
+ */
+class Heap {
+public:
+    /**
+     * Counters reported by --gc-stats
+     */
+    struct Stats {
+        std::size_t collections = 0;
+        std::size_t allocatedObjects = 0;
+        std::size_t freedObjects = 0;
+        std::size_t allocatedBytes = 0;
+        std::size_t freedBytes = 0;
+        std::size_t peakBytes = 0;
+        double collectionMilliseconds = 0.0;
+    };
+
+    Heap() = default;
+
+    Heap(const Heap&) = delete;
+    Heap& operator=(const Heap&) = delete;
+
+    /**
+     * Frees all objects still on the heap
+     */
+    ~Heap();
+
+    /**
+     * Allocate new object on the heap
+     * @param args constructor arguments
+     * @return pointer to the object, owned by the heap
+     */
+    template<typename T, typename... Args>
+    T* allocate(Args&&... args) {
+        void* memory = pool_.allocate(sizeof(T));
+        T* object;
+        try {
+            object = new(memory) T(std::forward<Args>(args)...);
+        } catch (...) {
+            pool_.release(memory, sizeof(T));
+            throw;
+        }
+        object->size_ = sizeof(T);
+        object->next_ = objects_;
+        objects_ = object;
+
+        bytesAllocated_ += sizeof(T);
+        stats_.allocatedObjects++;
+        stats_.allocatedBytes += sizeof(T);
+        updatePayload(object);
+        return object;
+    }
+
+    /**
+     * Account for a change of the memory an object owns outside of itself,
+     * has to be called whenever its payloadSize changes
+     * @param object object whose payload was allocated, resized or released
+     */
+    void updatePayload(Obj* object) {
+        const auto payload = object->payloadSize();
+        if (payload >= object->payload_) {
+            stats_.allocatedBytes += payload - object->payload_;
+        } else {
+            stats_.freedBytes += object->payload_ - payload;
+        }
+        bytesAllocated_ = bytesAllocated_ - object->payload_ + payload;
+        object->payload_ = payload;
+        if (bytesAllocated_ > stats_.peakBytes) { stats_.peakBytes = bytesAllocated_; }
+    }
+
+    /**
+     * Get the string with the given contents, allocated if it does not exist yet
+     * @param chars contents of the string
+     * @return interned string, owned by the heap
+     */
+    LoxString* intern(std::string_view chars);
+
+    /**
+     * Get the string with the given contents, allocated if it does not exist yet
+     * @param chars contents of the string, moved into a newly allocated string
+     * @return interned string, owned by the heap
+     */
+    LoxString* intern(std::string&& chars);
+
+    /**
+     * Exclude object from collection, used for objects referenced from
+     * outside of the heap for its whole lifetime, e.g. string literals in the AST
+     * @param object object to keep alive, may already be permanent
+     */
+    void makePermanent(Obj* object);
+
+    /**
+     * Intern string literal and make it permanent.
+     * Parsers on several threads may call this at the same time,
+     * as long as the heap is not used otherwise meanwhile
+     * @param chars contents of the literal
+     * @return interned string, owned by the heap
+     */
+    LoxString* internLiteral(std::string_view chars);
+
+    /**
+     * Check whether the heap grew past the collection threshold
+     * @return true if collect should be called at the next safe point
+     */
+    [[nodiscard]] bool shouldCollect() const { return bytesAllocated_ > nextCollection_; }
+
+    /**
+     * Run a full collection
+     * @param mark_roots callback marking all roots via markObject and markValue
+     */
+    void collect(const std::function<void()>& mark_roots);
+
+    /**
+     * Mark object as reachable
+     * @param object object to mark, may be null
+     */
+    void markObject(Obj* object) {
+        if (!object || object->marked_) { return; }
+        object->marked_ = true;
+        grayObjects_.push_back(object);
+    }
+
+    /**
+     * Mark value as reachable if it references an object
+     * @param value value to mark
+     */
+    void markValue(const LoxType& value) {
+        if (value.isObj()) { markObject(value.asObj()); }
+    }
+
+    /**
+     * Set the minimum heap size that triggers a collection
+     * @param bytes threshold in bytes
+     */
+    void setThreshold(std::size_t bytes);
+
+    /**
+     * Set how far the heap may grow relative to the live data after a collection
+     * before the next collection is triggered
+     * @param factor growth factor, at least 1
+     */
+    void setGrowthFactor(double factor);
+
+    [[nodiscard]] const Stats& getStats() const;
+
+    /**
+     * Get pool recycling the memory of freed objects
+     * @return pool of this heap
+     */
+    [[nodiscard]] const ObjectPool& getPool() const;
+
+    /**
+     * Get number of objects kept alive by makePermanent
+     * @return number of permanent objects
+     */
+    [[nodiscard]] std::size_t getPermanentCount() const;
+
+    /**
+     * Get size of the objects currently on the heap
+     * @return size in bytes
+     */
+    [[nodiscard]] std::size_t getBytesAllocated() const;
+
+    /**
+     * Print statistics in human readable form
+     * @param os stream to print to
+     */
+    void printStats(std::ostream& os) const;
+
+private:
+    friend class TemporaryRoot;
+
+    ObjectPool pool_;
+    StringTable strings_;
+    Obj* objects_ = nullptr;
+    std::vector<Obj*> permanentObjects_;
+    std::vector<Obj*> grayObjects_;
+    std::vector<Obj*> temporaryRoots_;
+
+    // Serializes internLiteral calls of parallel parsers
+    std::mutex literalMutex_;
+
+    std::size_t bytesAllocated_ = 0;
+    std::size_t threshold_ = 1024 * 1024;
+    std::size_t nextCollection_ = 1024 * 1024;
+    double growthFactor_ = 2.0;
+
+    Stats stats_;
+
+    void traceReferences();
+    void sweep();
+    void free(Obj* object);
+};
+
+/*!
+ * Scoped root for objects only referenced from native code,
+ * e.g. a function while its body executes
+ */
+class TemporaryRoot {
+public:
+    /**
+     * Constructor
+     * @param heap heap owning the object
+     * @param object object to keep alive until the end of the scope
+     */
+    TemporaryRoot(Heap& heap, Obj* object) : heap_{heap} {
+        heap_.temporaryRoots_.push_back(object);
+    }
+
+    TemporaryRoot(const TemporaryRoot&) = delete;
+    TemporaryRoot& operator=(const TemporaryRoot&) = delete;
+
+    ~TemporaryRoot() {
+        heap_.temporaryRoots_.pop_back();
+    }
+
+private:
+    Heap& heap_;
+};
+
+
+#endif //LOX_HEAP_H
@@ -0,0 +1,65 @@
+#ifndef LOX_INLINE_CACHE_H
+#define LOX_INLINE_CACHE_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+class LoxFunction;
+class Shape;
+
+/*!
+ * Result of a property lookup for one receiver shape
+ */
+struct PropertyCacheEntry {
+    std::uint64_t shapeId = 0;
+    std::size_t slot = 0;           // Slot of the field
+    LoxFunction* method = nullptr;  // Set if the property is a method instead of a field
+    Shape* transition = nullptr;    // Set by assignments adding the field, shape after the assignment
+};
+
+/*!
+ * Polymorphic inline cache of a single property access site.
+ * It remembers the lookups for the last few receiver shapes, so a hit is
+ * a comparison of the shape id followed by a load. Sites that see more
+ * shapes than there are entries stay on the slow path.
+ */
+class PropertyCache {
+public:
+    constexpr static std::size_t SIZE = 4;
+
+    /**
+     * Find cached lookup
+     * @param shape_id id of the receiver shape
+     * @return cached entry, null on a miss
+     */
+    [[nodiscard]] const PropertyCacheEntry* find(std::uint64_t shape_id) const {
+        for (std::size_t i = 0; i < count_; ++i) {
+            if (entries_[i].shapeId == shape_id) { return &entries_[i]; }
+        }
+        return nullptr;
+    }
+
+    /**
+     * Remember lookup, ignored if the cache is full
+     * @param entry result of the lookup
+     */
+    void add(const PropertyCacheEntry& entry) {
+        if (count_ < SIZE) { entries_[count_++] = entry; }
+    }
+
+private:
+    std::array<PropertyCacheEntry, SIZE> entries_{};
+    std::size_t count_ = 0;
+};
+
+/*!
+ * Hit counters of all inline caches of an interpreter, reported by --ic-stats
+ */
+struct InlineCacheStats {
+    std::size_t hits = 0;
+    std::size_t misses = 0;
+};
+
+
+#endif //LOX_INLINE_CACHE_H
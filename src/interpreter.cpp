@@ -9,8 +9,12 @@
 #include "loxclass.h"
 #include "loxinstance.h"
 #include "resolver.h"
+#include "compiler.h"
+#include "vm.h"
+#include "upvalue.h"
 
 #include <iostream>
+#include <limits>
 #include <utility>
 
 RuntimeError::RuntimeError(Token t, const std::string &message) : std::runtime_error(message), token_(std::move(t)) {
@@ -21,25 +25,90 @@ const Token& RuntimeError::getToken() const {
 }
 
 Interpreter::Interpreter()
-: valueStack_{}, globals_{std::make_shared<Environment>()}, environment_{globals_}, outputStream_{&std::cout}
+: valueStack_{}, globals_{heap_.allocate<Environment>()}, outputStream_{&std::cout},
+  vm_{std::make_unique<VM>(*this)}
 {
 }
 
 
 Interpreter::Interpreter(std::ostream *ostream)
-: valueStack_{}, globals_{std::make_shared<Environment>()}, environment_{globals_}, outputStream_{ostream}
+: valueStack_{}, globals_{heap_.allocate<Environment>()}, outputStream_{ostream},
+  vm_{std::make_unique<VM>(*this)}
 {
 }
 
-void Interpreter::interpret(std::vector<std::shared_ptr<Statement>>& program,
+Interpreter::~Interpreter() = default;
+
+void Interpreter::interpret(std::vector<AstPtr<Statement>>& program,
+                            std::size_t slot_count,
                             const std::shared_ptr<LoxInterpreter>& context) {
+    if (engine_ == Engine::BYTECODE_VM) {
+        try {
+            Compiler compiler;
+            auto script = compiler.compile(program);
+            vm_->interpret(*script, slot_count);
+        } catch (const RuntimeError& error) {
+            context->runtimeError(error);
+        }
+        return;
+    }
+
+    // Locals of blocks in top-level code get a register frame of their own
+    const auto prior_base = frameBase_;
+    frameBase_ = registers_.size();
+    registers_.resize(frameBase_ + slot_count);
+
     try {
-        for (std::shared_ptr<Statement>& stmt : program) {
+        for (AstPtr<Statement>& stmt : program) {
             execute(*stmt);
         }
     } catch (const RuntimeError& error) {
         context->runtimeError(error);
     }
+
+    registers_.resize(frameBase_);
+    frameBase_ = prior_base;
+}
+
+void Interpreter::setEngine(Engine engine) {
+    engine_ = engine;
+}
+
+void Interpreter::setNumberFormat(NumberFormat format) {
+    numberFormat_ = format;
+}
+
+void Interpreter::setOutputStream(std::ostream* ostream) {
+    outputStream_ = ostream;
+}
+
+void Interpreter::flushOutput() {
+    outputStream_->flush();
+}
+
+VM& Interpreter::getVM() {
+    return *vm_;
+}
+
+Heap& Interpreter::getHeap() {
+    return heap_;
+}
+
+void Interpreter::collectGarbage() {
+    heap_.collect([this]() { markRoots(); });
+}
+
+void Interpreter::markRoots() {
+    heap_.markObject(globals_);
+    for (const auto& value : valueStack_) {
+        heap_.markValue(value);
+    }
+    for (const auto& value : registers_) {
+        heap_.markValue(value);
+    }
+    heap_.markObject(currentFunction_);
+    heap_.markValue(returnValue_);
+    vm_->markRoots(heap_);
 }
 
 LoxType Interpreter::evaluate(Expression& expr) {
@@ -47,85 +116,64 @@ LoxType Interpreter::evaluate(Expression& expr) {
     return valueStack_.back();
 }
 
-void Interpreter::execute(Statement& statement) {
+Completion Interpreter::execute(Statement& statement) {
+    // Statement boundaries are safe points: all live values are reachable from the roots
+    if (heap_.shouldCollect()) { collectGarbage(); }
     statement.accept(*this);
+    return completion_;
 }
 
 void Interpreter::visitBinary(Binary& b) {
     evaluate(*b.getLeft());
     evaluate(*b.getRight());
 
-    // Get result of left and right
-    LoxType right_val = valueStack_.back();
-    valueStack_.pop_back();
-    LoxType left_val = valueStack_.back();
+    // The result replaces the left operand on the value stack
+    const LoxType right_val = valueStack_.back();
     valueStack_.pop_back();
+    LoxType& result = valueStack_.back();
+    const LoxType left_val = result;
 
     switch (b.getOperator().getType()) {
         case TokenType::MINUS:
             checkNumberOperands(b.getOperator(), left_val, right_val);
-            valueStack_.emplace_back(toDouble(left_val) - toDouble(right_val));
+            result = toDouble(left_val) - toDouble(right_val);
             break;
         case TokenType::SLASH:
             checkNumberOperands(b.getOperator(), left_val, right_val);
-            valueStack_.emplace_back(toDouble(left_val) / toDouble(right_val));
+            result = toDouble(left_val) / toDouble(right_val);
             break;
         case TokenType::STAR:
             checkNumberOperands(b.getOperator(), left_val, right_val);
-            valueStack_.emplace_back(toDouble(left_val) * toDouble(right_val));
+            result = toDouble(left_val) * toDouble(right_val);
             break;
-
         case TokenType::PLUS:
-            if (std::holds_alternative<double>(left_val) && std::holds_alternative<double>(right_val)) {
-                double left = std::get<double>(left_val);
-                double right = std::get<double>(right_val);
-                valueStack_.emplace_back(left + right);
-            } else if (std::holds_alternative<std::string>(left_val) && std::holds_alternative<std::string>(right_val)) {
-                const std::string& left = std::get<std::string>(left_val);
-                const std::string& right = std::get<std::string>(right_val);
-                valueStack_.emplace_back(left + right);
-            } else if ((std::holds_alternative<std::string>(left_val) && std::holds_alternative<double>(right_val)) ||
-                    (std::holds_alternative<double>(left_val) && std::holds_alternative<std::string>(right_val))) {
-                if (std::holds_alternative<double>(left_val)) {
-                    const std::string& right = std::get<std::string>(right_val);
-                    const std::string left = std::to_string(std::get<double>(left_val));
-                    valueStack_.emplace_back(left + right);
-                } else {
-                    const std::string& left = std::get<std::string>(left_val);
-                    const std::string right = std::to_string(std::get<double>(right_val));
-                    valueStack_.emplace_back(left + right);
-                }
-            }
-            else {
-                throw RuntimeError(b.getOperator(), "Operands must be numbers or strings");
-            }
+            result = add(b.getOperator(), left_val, right_val);
             break;
 
         case TokenType::GREATER:
             checkNumberOperands(b.getOperator(), left_val, right_val);
-            valueStack_.emplace_back(toDouble(left_val) > toDouble(right_val));
+            result = toDouble(left_val) > toDouble(right_val);
             break;
         case TokenType::GREATER_EQUAL:
             checkNumberOperands(b.getOperator(), left_val, right_val);
-            valueStack_.emplace_back(toDouble(left_val) >= toDouble(right_val));
+            result = toDouble(left_val) >= toDouble(right_val);
             break;
         case TokenType::LESS:
             checkNumberOperands(b.getOperator(), left_val, right_val);
-            valueStack_.emplace_back(toDouble(left_val) < toDouble(right_val));
+            result = toDouble(left_val) < toDouble(right_val);
             break;
         case TokenType::LESS_EQUAL:
             checkNumberOperands(b.getOperator(), left_val, right_val);
-            valueStack_.emplace_back(toDouble(left_val) <= toDouble(right_val));
+            result = toDouble(left_val) <= toDouble(right_val);
             break;
 
         case TokenType::BANG_EQUAL:
-            valueStack_.emplace_back(!isEqual(left_val, right_val));
+            result = !isEqual(left_val, right_val);
             break;
         case TokenType::EQUAL_EQUAL:
-            valueStack_.emplace_back(isEqual(left_val, right_val));
+            result = isEqual(left_val, right_val);
             break;
         case TokenType::COMMA:
-            valueStack_.emplace_back(left_val);
             break;
         default:
             throw std::runtime_error("This should never happen.");
@@ -134,11 +182,10 @@ void Interpreter::visitBinary(Binary& b) {
 
 void Interpreter::visitTernary(Ternary &t) {
     evaluate(*t.getLeft());
-
-    LoxType result_val = valueStack_.back();
+    const bool condition = isTruthy(valueStack_.back());
     valueStack_.pop_back();
 
-    if (isTruthy(result_val)) {
+    if (condition) {
         evaluate(*t.getMiddle());
     } else {
         evaluate(*t.getRight());
@@ -156,16 +203,15 @@ void Interpreter::visitLiteral(Literal& l) {
 void Interpreter::visitUnary(Unary& u) {
     evaluate(*u.getRight());
 
-    // Get result of expression
-    LoxType result_val = valueStack_.back();
-    valueStack_.pop_back();
+    // The result replaces the operand
+    LoxType& result = valueStack_.back();
 
     switch (u.getOperator().getType()) {
         case TokenType::BANG:
-            valueStack_.emplace_back(!isTruthy(result_val));
+            result = !isTruthy(result);
             break;
         case TokenType::MINUS:
-            valueStack_.emplace_back(negate(u.getOperator(), result_val));
+            result = negate(u.getOperator(), result);
             break;
         default:
             throw std::runtime_error("This should never happen.");
@@ -173,74 +219,63 @@ void Interpreter::visitUnary(Unary& u) {
 }
 
 void Interpreter::visitVariableAccess(VariableAccess& v) {
-    valueStack_.emplace_back(lookUpVariable(&v));
+    valueStack_.emplace_back(lookUpVariable(v.getLocation()));
 }
 
 void Interpreter::visitAssignment(Assignment& a) {
+    // The value stays on the stack as the result of the assignment
     evaluate(*a.getValue());
-    // Get result of expression
-    LoxType result_val = valueStack_.back();
-
-    if (exprLocations_.count(&a)) {
-        const auto& location = exprLocations_[&a];
-        const auto index = location.first;
-        const auto depth = location.second;
-        if (depth == Resolver::GLOBAL_DEPTH) {
-            globals_->assign(index, result_val);
-        } else {
-            environment_->assignAt(index, result_val, static_cast<int>(depth));
-        }
-    } else {
-        throw std::runtime_error("Unresolved variable.");
-    }
+    assignVariable(a.getLocation(), valueStack_.back());
 }
 
 void Interpreter::visitLogical(Logical& l) {
-    // Evaluate left first
+    // Evaluate left first, it stays on the stack as the result if it short-circuits
     evaluate(*l.getLeft());
-    LoxType left_val = valueStack_.back();
-    valueStack_.pop_back();
-
-    if (l.getOperator().getType() == TokenType::OR) {
-        if (isTruthy(left_val)) {
-            valueStack_.emplace_back(left_val);
-            return;
-        }
-    } else {
-        if (!isTruthy(left_val)) {
-            valueStack_.emplace_back(left_val);
-            return;
-        }
-    }
+    const bool truthy = isTruthy(valueStack_.back());
+    if (truthy == (l.getOperator().getType() == TokenType::OR)) { return; }
 
+    valueStack_.pop_back();
     evaluate(*l.getRight());
 }
 
 void Interpreter::visitCall(Call &c) {
-    evaluate(*c.getCallee());
-    LoxType left_val = valueStack_.back();
-    valueStack_.pop_back();
+    LoxFunction* method = nullptr;
+    LoxInstance* receiver = nullptr;
+
+    if (auto* property = c.getInvokedProperty()) {
+        // object.name(...) calls methods directly, without creating a bound method.
+        // The receiver takes the place of the callee on the value stack
+        evaluate(*property->getObject());
+        LoxType object = valueStack_.back();
+        if (!object.isObjType(ObjType::INSTANCE)) {
+            throw RuntimeError(property->getName(),
+                               "Only instances have properties.");
+        }
 
-    if (std::holds_alternative<std::shared_ptr<Callable>>(left_val) ||
-        std::holds_alternative<std::shared_ptr<LoxClass>>(left_val) ) {
-        std::shared_ptr<Callable> callable{};
+        receiver = object.as<LoxInstance>();
+        LoxType field;
+        method = lookUpProperty(receiver, property->getName(), property->getCache(), field);
+        if (!method) { valueStack_.back() = field; }
+    } else {
+        evaluate(*c.getCallee());
+    }
+    LoxType left_val = valueStack_.back();
 
-        if (std::holds_alternative<std::shared_ptr<Callable>>(left_val)) {
-            callable = std::get<std::shared_ptr<Callable>>(left_val);
-        } else {
-            callable = std::get<std::shared_ptr<LoxClass>>(left_val);
-        }
+    if (method || left_val.isCallable()) {
+        Callable* callable = method;
+        if (!method) { callable = left_val.as<Callable>(); }
 
-        std::vector<LoxType> arguments;
+        // Callee and arguments stay on the value stack until the call returns, so they are
+        // rooted while other arguments run function bodies. The callee reads them in place
+        const auto first_argument = valueStack_.size();
         for (auto& argument : c.getArguments()) {
             evaluate(*argument);
-            LoxType result = valueStack_.back();
-            valueStack_.pop_back();
-            arguments.push_back(result);
         }
+        Arguments arguments{valueStack_.data() + first_argument, valueStack_.size() - first_argument};
 
-        if (arguments.size() == callable->arity()) {
-            LoxType ret_val = callable->call(*this, arguments);
+        if (arguments.size() == static_cast<std::size_t>(callable->arity())) {
+            LoxType ret_val = method ? method->callMethod(*this, receiver, arguments) : callable->call(*this, arguments);
+            valueStack_.resize(first_argument - 1);
             valueStack_.push_back(ret_val);
         } else {
             throw RuntimeError(c.getParen(), "Expected " +
@@ -254,12 +289,10 @@ void Interpreter::visitCall(Call &c) {
 
 void Interpreter::visitGetExpression(GetExpression& g) {
     evaluate(*g.getObject());
-    LoxType val = valueStack_.back();
-    valueStack_.pop_back();
+    LoxType& object = valueStack_.back();
 
-    if (std::holds_alternative<std::shared_ptr<LoxInstance>>(val)) {
-        auto ptr = std::get<std::shared_ptr<LoxInstance>>(val);
-        valueStack_.emplace_back(ptr->get(g.getName()));
+    if (object.isObjType(ObjType::INSTANCE)) {
+        object = getProperty(object.as<LoxInstance>(), g.getName(), g.getCache());
         return;
     }
 
@@ -270,44 +303,38 @@ void Interpreter::visitGetExpression(GetExpression& g) {
 void Interpreter::visitSetExpression(SetExpression& s) {
     evaluate(*s.getObject());
     LoxType obj = valueStack_.back();
-    valueStack_.pop_back();
 
-    if (!std::holds_alternative<std::shared_ptr<LoxInstance>>(obj)) {
+    if (!obj.isObjType(ObjType::INSTANCE)) {
         throw RuntimeError(s.getName(),
                            "Only instances have properties.");
     }
 
-    auto ptr = std::get<std::shared_ptr<LoxInstance>>(obj);
+    auto* ptr = obj.as<LoxInstance>();
 
+    // The object stays on the value stack while the value is evaluated
+    // and is replaced by the value as the result of the assignment
     evaluate(*s.getValue());
-    LoxType val = valueStack_.back();
+    const LoxType val = valueStack_.back();
     valueStack_.pop_back();
+    valueStack_.back() = val;
 
-    ptr->set(s.getName(), val);
-    valueStack_.emplace_back(val);
+    setProperty(ptr, s.getName(), val, s.getCache());
 }
 
 void Interpreter::visitThisExpression(ThisExpression &t) {
-    valueStack_.emplace_back(lookUpVariable(&t));
+    valueStack_.emplace_back(lookUpVariable(t.getLocation()));
 }
 
 void Interpreter::visitSuperExpression(SuperExpression& s) {
-    auto super = std::get<std::shared_ptr<LoxClass>>(lookUpVariable(&s));
-    auto super_distance = exprLocations_[&s].second;
-    auto object = environment_->getAt(0, super_distance - 1);
-    auto method = super->getMethod(s.getMethod());
+    auto* super = lookUpVariable(s.getLocation()).as<LoxClass>();
+    auto object = lookUpVariable(s.getThisLocation());
+    auto method = getSuperMethod(super, s.getMethod(), s.getCache());
 
-    if (!method) {
-        throw RuntimeError(s.getMethod(),
-                           "Undefined property '" + s.getMethod().getLexeme() + "'.");
-    }
-
-    valueStack_.emplace_back(method->bind(std::get<std::shared_ptr<LoxInstance>>(object)));
+    valueStack_.emplace_back(method->bind(object.as<LoxInstance>(), heap_));
 }
 
 void Interpreter::visitFunctionExpression(FunctionExpression& f) {
-    std::shared_ptr<LoxFunction> l = std::make_shared<LoxFunction>(f, getEnvironment(), false);
-    valueStack_.emplace_back(l);
+    valueStack_.emplace_back(makeClosure(f.getPrototype(), FunctionKind::FUNCTION));
 }
 
 void Interpreter::visitExpressionStatement(ExpressionStatement& s) {
@@ -318,10 +345,9 @@ void Interpreter::visitExpressionStatement(ExpressionStatement& s) {
 
 void Interpreter::visitPrintStatement(PrintStatement &p) {
     evaluate(*p.getExpression());
-    LoxType result_val = valueStack_.back();
+    printValue(*outputStream_, valueStack_.back(), numberFormat_);
+    *outputStream_ << '\n';
     valueStack_.pop_back();
-
-    *outputStream_ << stringify(result_val) << '\n';
 }
 
 void Interpreter::visitVariableDeclaration(VariableDeclaration& v) {
@@ -333,22 +359,21 @@ void Interpreter::visitVariableDeclaration(VariableDeclaration& v) {
         valueStack_.pop_back();
     }
 
-    environment_->define(value);
+    defineVariable(v.getLocation(), value);
 }
 
 void Interpreter::visitBlock(Block& b) {
-    std::shared_ptr<Environment> new_environment = std::make_shared<Environment>();
-    new_environment->setEnclosing(environment_);
-    executeBlock(b.getStatements(), new_environment);
+    executeBlock(b.getStatements());
 }
 
 void Interpreter::visitIfStatement(IfStatement& i) {
     // Evaluate condition
     evaluate(*i.getCondition());
-    LoxType condition = valueStack_.back();
+    const bool condition = isTruthy(valueStack_.back());
     valueStack_.pop_back();
 
-    if (isTruthy(condition)) {
+    // Completion of the branch is left in completion_ for the enclosing block
+    if (condition) {
         execute(*i.getThenBranch());
     } else if (i.getElseBranch()) {
         execute(*i.getElseBranch());
@@ -358,279 +383,382 @@ void Interpreter::visitIfStatement(IfStatement& i) {
 void Interpreter::visitWhileStatement(WhileStatement &w) {
     // Evaluate condition
     evaluate(*w.getCondition());
-    LoxType condition = valueStack_.back();
+    bool condition = isTruthy(valueStack_.back());
     valueStack_.pop_back();
 
-    try {
-        while (isTruthy(condition)) {
-            execute(*w.getThenBranch());
-            evaluate(*w.getCondition());
-            condition = valueStack_.back();
-            valueStack_.pop_back();
+    while (condition) {
+        auto completion = execute(*w.getThenBranch());
+        if (completion == Completion::BREAK) {
+            completion_ = Completion::NORMAL;
+            return;
         }
-    } catch (const BreakException& b) {
+        if (completion == Completion::RETURN) { return; }
+
+        evaluate(*w.getCondition());
+        condition = isTruthy(valueStack_.back());
+        valueStack_.pop_back();
     }
 }
 
-void Interpreter::visitBreakStatement(BreakStatement &b) {
-    throw BreakException{};
+void Interpreter::visitBreakStatement(BreakStatement &) {
+    completion_ = Completion::BREAK;
 }
 
 void Interpreter::visitFunction(Function& f) {
-    std::shared_ptr<LoxFunction> function = std::make_shared<LoxFunction>(f, environment_, false);
-    environment_->define(function);
+    // A local function calling itself captures its own variable, which has to exist first
+    defineVariable(f.getLocation(), NullType{});
+    assignVariable(f.getLocation(), makeClosure(f.getPrototype(), FunctionKind::FUNCTION));
 }
 
 void Interpreter::visitReturn(Return& r) {
-    LoxType value = NullType{};
     if (r.getValue()) {
-        value = evaluate(*r.getValue());
+        evaluate(*r.getValue());
+        returnValue_ = std::move(valueStack_.back());
         valueStack_.pop_back();
+    } else {
+        returnValue_ = NullType{};
     }
 
-    throw ReturnException{value};
+    completion_ = Completion::RETURN;
 }
 
 void Interpreter::visitClassDeclaration(ClassDeclaration& c) {
     LoxType superclass;
     if (c.getSuperclass()) {
-        superclass = evaluate(*c.getSuperclass());
-        if (!std::holds_alternative<std::shared_ptr<LoxClass>>(superclass)) {
+        evaluate(*c.getSuperclass());
+        superclass = valueStack_.back();
+        valueStack_.pop_back();
+        if (!superclass.isObjType(ObjType::CLASS)) {
             throw RuntimeError(c.getSuperclass()->getToken(),
                                "Superclass must be class");
         }
     }
 
-    auto index = environment_->define();
-    std::shared_ptr<Environment> current = environment_;
-
+    // Methods may capture the class variable and super, both have to exist first
+    defineVariable(c.getLocation(), NullType{});
     if (c.getSuperclass()) {
-        std::shared_ptr<Environment> env = std::make_shared<Environment>();
-        env->setEnclosing(environment_);
-        env->define(superclass);
-        environment_ = env;
+        defineVariable(c.getSuperLocation(), superclass);
     }
 
-    std::unordered_map<Token, std::shared_ptr<LoxFunction>> methods;
-    for (const std::shared_ptr<Function>& function : c.getMethods()) {
-        std::shared_ptr<LoxFunction> method;
+    std::unordered_map<Token, LoxFunction*> methods;
+    for (const AstPtr<Function>& function : c.getMethods()) {
+        LoxFunction* method;
         if (function->getName().getLexeme() != "init") {
-            method = std::make_shared<LoxFunction>(*function, environment_, false);
+            method = makeClosure(function->getPrototype(), FunctionKind::METHOD);
         } else {
-            method = std::make_shared<LoxFunction>(*function, environment_, true);
+            method = makeClosure(function->getPrototype(), FunctionKind::INITIALIZER);
         }
         methods[function->getName()] = method;
     }
 
     if (c.getSuperclass()) {
-        environment_ = current;
-        std::shared_ptr<LoxClass> l = std::make_shared<LoxClass>(c.getName().getLexeme(), methods,
-                                                                 std::get<std::shared_ptr<LoxClass>>(superclass));
-        environment_->assign(index, l);
+        auto* l = heap_.allocate<LoxClass>(std::string{c.getName().getLexeme()}, methods, superclass.as<LoxClass>());
+        assignVariable(c.getLocation(), l);
     } else {
-        std::shared_ptr<LoxClass> l = std::make_shared<LoxClass>(c.getName().getLexeme(), methods);
-        environment_->assign(index, l);
+        auto* l = heap_.allocate<LoxClass>(std::string{c.getName().getLexeme()}, methods);
+        assignVariable(c.getLocation(), l);
     }
 }
 
 bool Interpreter::isTruthy(const LoxType& t) {
-    bool return_value;
-
-    std::visit(overload{
-            [&](double d) {
-                return_value = true;
-            },
-            [&](const std::string& s) {
-                return_value = true;
-            },
-            [&](const NullType& n) {
-                return_value = false;
-            },
-            [&](bool b) {
-                return_value = b;
-            },
-            [&](const std::shared_ptr<Callable>& c) {
-                return_value = true;
-            },
-            [&](const std::shared_ptr<LoxClass>& c) {
-                return_value = true;
-            },
-            [&](const std::shared_ptr<LoxInstance>& c) {
-                return_value = true;
-            }
-    }, t);
-
-    return return_value;
+    if (t.isBool()) { return t.asBool(); }
+    return !t.isNil();
 }
 
 double Interpreter::negate(const Token& op, const LoxType &t) {
-    double return_value = 0;
-
-    std::visit(overload{
-            [&](double d) {
-                return_value = -d;
-            },
-            [&](const std::string& s) {
-                throw RuntimeError(op, "Cannot negate string.");
-            },
-            [&](const NullType& n) {
-                throw RuntimeError(op, "Cannot negate null.");
-            },
-            [&](bool b) {
-                return_value = -static_cast<double>(b);
-            },
-            [&](const std::shared_ptr<Callable>& c) {
-                throw RuntimeError(op, "Cannot negate callable.");
-            },
-            [&](const std::shared_ptr<LoxClass>& c) {
-                throw RuntimeError(op, "Cannot negate class.");
-            },
-            [&](const std::shared_ptr<LoxInstance>& c) {
-                throw RuntimeError(op, "Cannot negate object.");
-            }
-    }, t);
-
-    return return_value;
+    if (t.isNumber()) { return -t.asNumber(); }
+    if (t.isBool()) { return -static_cast<double>(t.asBool()); }
+    if (t.isNil()) { throw RuntimeError(op, "Cannot negate null."); }
+
+    switch (t.asObj()->getType()) {
+        case ObjType::STRING:
+            throw RuntimeError(op, "Cannot negate string.");
+        case ObjType::CLASS:
+            throw RuntimeError(op, "Cannot negate class.");
+        case ObjType::INSTANCE:
+            throw RuntimeError(op, "Cannot negate object.");
+        default:
+            throw RuntimeError(op, "Cannot negate callable.");
+    }
 }
 
 double Interpreter::toDouble(const LoxType &t) {
-    double return_value = 0;
-
-    std::visit(overload{
-            [&](double d) {
-                return_value = d;
-            },
-            [&](const std::string& s) {
-                return_value = std::numeric_limits<double>::quiet_NaN();
-            },
-            [&](const NullType& n) {
-                return_value = std::numeric_limits<double>::quiet_NaN();
-            },
-            [&](bool b) {
-                return_value = static_cast<double>(b);
-            },
-            [&](const std::shared_ptr<Callable>& c) {
-                return_value = std::numeric_limits<double>::quiet_NaN();
-            },
-            [&](const std::shared_ptr<LoxClass>& c) {
-                return_value = std::numeric_limits<double>::quiet_NaN();
-            },
-            [&](const std::shared_ptr<LoxInstance>& c) {
-                return_value = std::numeric_limits<double>::quiet_NaN();
-            }
-    }, t);
-
-    return return_value;
+    if (t.isNumber()) { return t.asNumber(); }
+    if (t.isBool()) { return static_cast<double>(t.asBool()); }
+    return std::numeric_limits<double>::quiet_NaN();
 }
 
 bool Interpreter::isEqual(const LoxType& t1, const LoxType& t2) {
-    bool return_value = false;
-
-    std::visit(overload{
-            [&](double d) {
-                return_value = toDouble(t2) == d;
-            },
-            [&](const std::string& s) {
-                if (std::holds_alternative<std::string>(t2)) {
-                    const auto& s1 = std::get<std::string>(t2);
-                    return_value = s1 == s;
-                }
-            },
-            [&](const NullType& n) {
-                if (std::holds_alternative<NullType>(t2)) {
-                    return_value = true;
-                }
-            },
-            [&](bool b) {
-                return_value = b == isTruthy(t2);
-            },
-            [&](const std::shared_ptr<Callable>& c) {
-                if (std::holds_alternative<std::shared_ptr<Callable>>(t2)) {
-                    const auto& c1 = std::get<std::shared_ptr<Callable>>(t2);
-                    return_value = c == c1;
-                } else {
-                    return_value = false;
-                }
-            },
-            [&](const std::shared_ptr<LoxClass>& c) {
-                if (std::holds_alternative<std::shared_ptr<LoxClass>>(t2)) {
-                    const auto& c1 = std::get<std::shared_ptr<LoxClass>>(t2);
-                    return_value = c == c1;
-                } else {
-                    return_value = false;
-                }
-            },
-            [&](const std::shared_ptr<LoxInstance>& c) {
-                if (std::holds_alternative<std::shared_ptr<LoxInstance>>(t2)) {
-                    const auto& c1 = std::get<std::shared_ptr<LoxInstance>>(t2);
-                    return_value = c == c1;
-                } else {
-                    return_value = false;
-                }
-            }
-    }, t1);
+    if (t1.isNumber()) { return toDouble(t2) == t1.asNumber(); }
+    if (t1.isBool()) { return t1.asBool() == isTruthy(t2); }
+
+    if (t1.isString() && t2.isString() && !t1.identical(t2)) {
+        // Distinct interned strings differ, ropes have to compare their contents
+        const auto* s1 = t1.as<LoxString>();
+        const auto* s2 = t2.as<LoxString>();
+        if (s1->isInterned() && s2->isInterned()) { return false; }
+        return s1->getLength() == s2->getLength() && s1->getValue() == s2->getValue();
+    }
 
-    return return_value;
+    // Nil and the remaining objects compare by identity
+    return t1.identical(t2);
 }
 
 void Interpreter::checkNumberOperands(const Token& op, const LoxType& t1, const LoxType& t2) {
-    if (std::holds_alternative<double>(t1) && std::holds_alternative<double>(t2)) {
+    if (t1.isNumber() && t2.isNumber()) {
         return;
     }
 
     throw RuntimeError(op, "Operands must be numbers");
 }
 
-void Interpreter::executeBlock(const std::vector<std::shared_ptr<Statement>>& statements,
-                               std::shared_ptr<Environment> new_environment) {
-    // Create a pointer to restore environment in case of error
-    std::shared_ptr<Environment> prior_environment = environment_;
-    try {
-        environment_ = std::move(new_environment);
+Completion Interpreter::executeBlock(const std::vector<AstPtr<Statement>>& statements) {
+    Completion completion = Completion::NORMAL;
+    for (const auto& statement : statements) {
+        completion = execute(*statement);
+        if (completion != Completion::NORMAL) { break; }
+    }
+    return completion;
+}
 
-        for (const auto& statement : statements) {
-            execute(*statement);
-        }
-    } catch(...) {
-        environment_ = prior_environment;
+LoxType Interpreter::callFunction(LoxFunction* function, LoxInstance* receiver, Arguments arguments) {
+    const FunctionPrototype& prototype = function->getPrototype();
+
+    // The function has to outlive its body, e.g. a bound method is only referenced from here
+    TemporaryRoot root{heap_, function};
+
+    const auto prior_base = frameBase_;
+    auto* prior_function = currentFunction_;
+    const auto base = registers_.size();
+    registers_.resize(base + prototype.slotCount);
+
+    auto slot = base;
+    if (function->isMethod()) { registers_[slot++] = receiver; }
+    for (const auto& argument : arguments) {
+        registers_[slot++] = argument;
+    }
+    for (auto captured : prototype.capturedParameters) {
+        registers_[base + captured] = heap_.allocate<Upvalue>(registers_[base + captured]);
+    }
+
+    frameBase_ = base;
+    currentFunction_ = function;
+    try {
+        executeBlock(prototype.body);
+    } catch (...) {
+        registers_.resize(base);
+        frameBase_ = prior_base;
+        currentFunction_ = prior_function;
         throw;
     }
 
-    environment_ = prior_environment;
+    registers_.resize(base);
+    frameBase_ = prior_base;
+    currentFunction_ = prior_function;
+    return takeReturnValue();
 }
 
-const std::shared_ptr<Environment>& Interpreter::getEnvironment() const {
-    return environment_;
+LoxType Interpreter::takeReturnValue() {
+    // A break never completes a function body, the parser only allows it within a loop of the same function
+    LoxType value = NullType{};
+    if (completion_ == Completion::RETURN) {
+        value = std::move(returnValue_);
+    }
+    completion_ = Completion::NORMAL;
+    return value;
+}
+
+const LoxType& Interpreter::lookUpVariable(const VariableLocation& location) const {
+    switch (location.kind) {
+        case VariableLocation::Kind::GLOBAL:
+            return globals_->get(location.index);
+        case VariableLocation::Kind::LOCAL: {
+            const LoxType& value = registers_[frameBase_ + location.index];
+            return location.captured ? value.as<Upvalue>()->get() : value;
+        }
+        default:
+            return currentFunction_->getUpvalue(location.index)->get();
+    }
 }
 
-void Interpreter::resolve(Expression* expr, std::size_t location, std::size_t depth) {
-    exprLocations_[expr] = std::make_pair(location, depth);
+void Interpreter::assignVariable(const VariableLocation& location, LoxType value) {
+    switch (location.kind) {
+        case VariableLocation::Kind::GLOBAL:
+            globals_->assign(location.index, value);
+            break;
+        case VariableLocation::Kind::LOCAL: {
+            LoxType& target = registers_[frameBase_ + location.index];
+            if (location.captured) {
+                target.as<Upvalue>()->set(value);
+            } else {
+                target = value;
+            }
+            break;
+        }
+        default:
+            currentFunction_->getUpvalue(location.index)->set(value);
+            break;
+    }
 }
 
-LoxType Interpreter::lookUpVariable(Expression* expr) {
-    const auto& location = exprLocations_[expr];
-    const auto loc = location.first;
-    const auto depth = location.second;
+void Interpreter::defineVariable(const VariableLocation& location, LoxType value) {
+    if (location.isGlobal()) {
+        globals_->define(value);
+        return;
+    }
 
-    if (depth == Resolver::GLOBAL_DEPTH) {
-        return globals_->get(loc);
+    // Captured locals get a new cell every time the declaration runs, e.g. once per loop iteration
+    LoxType& target = registers_[frameBase_ + location.index];
+    if (location.captured) {
+        target = heap_.allocate<Upvalue>(value);
     } else {
-        return environment_->getAt(loc, static_cast<int>(depth));
+        target = value;
     }
 }
 
+LoxFunction* Interpreter::makeClosure(const FunctionPrototype& prototype, FunctionKind kind) {
+    std::vector<Upvalue*> upvalues;
+    upvalues.reserve(prototype.upvalues.size());
+    for (const auto& upvalue : prototype.upvalues) {
+        if (upvalue.local) {
+            upvalues.push_back(registers_[frameBase_ + upvalue.index].as<Upvalue>());
+        } else {
+            upvalues.push_back(currentFunction_->getUpvalue(upvalue.index));
+        }
+    }
+    return heap_.allocate<LoxFunction>(prototype, std::move(upvalues), kind);
+}
+
 void Interpreter::defineGlobal(LoxType value) {
     globals_->define(std::move(value));
 }
 
+const InlineCacheStats& Interpreter::getCacheStats() const {
+    return cacheStats_;
+}
 
-ReturnException::ReturnException(LoxType value)
-    : value_(std::move(value))
-{
+LoxType Interpreter::getProperty(LoxInstance* instance, const Token& name, PropertyCache& cache) {
+    LoxType field;
+    if (auto* method = lookUpProperty(instance, name, cache, field)) {
+        return method->bind(instance, heap_);
+    }
+    return field;
+}
+
+LoxFunction* Interpreter::lookUpProperty(LoxInstance* instance, const Token& name, PropertyCache& cache,
+                                         LoxType& field) {
+    const Shape* shape = instance->getShape();
+    if (const auto* entry = cache.find(shape->getId())) {
+        cacheStats_.hits++;
+        if (entry->method) { return entry->method; }
+        field = instance->getSlot(entry->slot);
+        return nullptr;
+    }
+
+    // Fields shadow methods. Adding a field changes the shape, so cached methods stay valid
+    cacheStats_.misses++;
+    if (auto slot = shape->lookup(name.getLexeme())) {
+        cache.add(PropertyCacheEntry{shape->getId(), *slot});
+        field = instance->getSlot(*slot);
+        return nullptr;
+    }
 
+    if (auto* method = instance->getClass()->getMethod(name)) {
+        cache.add(PropertyCacheEntry{shape->getId(), 0, method});
+        return method;
+    }
+
+    throw RuntimeError(name,
+                       "Undefined property '" + std::string{name.getLexeme()} + "'.");
 }
 
-const LoxType& ReturnException::getValue() const {
-    return value_;
+void Interpreter::setProperty(LoxInstance* instance, const Token& name, LoxType value, PropertyCache& cache) {
+    Shape* shape = instance->getShape();
+    if (const auto* entry = cache.find(shape->getId())) {
+        cacheStats_.hits++;
+        if (entry->transition) {
+            instance->addField(heap_, entry->transition, value);
+        } else {
+            instance->setSlot(entry->slot, value);
+        }
+        return;
+    }
+
+    cacheStats_.misses++;
+    if (auto slot = shape->lookup(name.getLexeme())) {
+        cache.add(PropertyCacheEntry{shape->getId(), *slot});
+        instance->setSlot(*slot, value);
+        return;
+    }
+
+    Shape* transition = shape->addField(name.getLexeme());
+    cache.add(PropertyCacheEntry{shape->getId(), 0, nullptr, transition});
+    instance->addField(heap_, transition, value);
 }
 
+LoxFunction* Interpreter::getSuperMethod(LoxClass* superclass, const Token& name, PropertyCache& cache) {
+    // The root shape identifies the class
+    const auto class_id = superclass->getRootShape()->getId();
+    if (const auto* entry = cache.find(class_id)) {
+        cacheStats_.hits++;
+        return entry->method;
+    }
+
+    cacheStats_.misses++;
+    auto* method = superclass->getMethod(name);
+    if (!method) {
+        throw RuntimeError(name,
+                           "Undefined property '" + std::string{name.getLexeme()} + "'.");
+    }
+
+    cache.add(PropertyCacheEntry{class_id, 0, method});
+    return method;
+}
+
+
+LoxType Interpreter::add(const Token& op, const LoxType& left, const LoxType& right) {
+    if (left.isNumber() && right.isNumber()) {
+        return left.asNumber() + right.asNumber();
+    }
+    if (left.isString() && right.isString()) {
+        return concatenate(left.as<LoxString>(), right.as<LoxString>());
+    }
+
+    // Formatted numbers only become strings of their own if they end up in a rope
+    if (left.isString() && right.isNumber()) {
+        auto* string = left.as<LoxString>();
+        auto number = formatNumber(right.asNumber(), numberFormat_);
+        if (string->getLength() + number.length < LoxString::MIN_ROPE_LENGTH) {
+            return concatenate(string->getValue(), number.view());
+        }
+        return concatenate(string, heap_.intern(number.view()));
+    }
+    if (left.isNumber() && right.isString()) {
+        auto number = formatNumber(left.asNumber(), numberFormat_);
+        auto* string = right.as<LoxString>();
+        if (number.length + string->getLength() < LoxString::MIN_ROPE_LENGTH) {
+            return concatenate(number.view(), string->getValue());
+        }
+        return concatenate(heap_.intern(number.view()), string);
+    }
+    throw RuntimeError(op, "Operands must be numbers or strings");
+}
+
+LoxString* Interpreter::concatenate(LoxString* left, LoxString* right) {
+    // Long results are ropes, copying them on every append would be quadratic
+    if (left->getLength() + right->getLength() >= LoxString::MIN_ROPE_LENGTH) {
+        return heap_.allocate<LoxString>(left, right, heap_);
+    }
+
+    // Both parts are short and thereby flat
+    return concatenate(left->getValue(), right->getValue());
+}
+
+LoxString* Interpreter::concatenate(std::string_view left, std::string_view right) {
+    // Sized up front, so the result is built with a single allocation
+    std::string result;
+    result.reserve(left.size() + right.size());
+    result.append(left);
+    result.append(right);
+    return heap_.intern(std::move(result));
+}
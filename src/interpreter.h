@@ -9,6 +9,8 @@
 #include "expressions.h"
 #include "statements.h"
 #include "environment.h"
+#include "heap.h"
+#include "inline_cache.h"
 
 #include <vector>
 #include <string_view>
@@ -16,6 +18,19 @@
 #include <ostream>
 
 class LoxInterpreter;
+class LoxClass;
+class LoxFunction;
+class LoxInstance;
+class VM;
+enum class FunctionKind;
+
+/**
+ * Available execution engines
+ */
+enum class Engine {
+    TREE_WALKER, // Walks the AST directly
+    BYTECODE_VM  // Compiles the AST to bytecode and runs it on the VM
+};
 
 /*!
  * Represents runtime errors in Lox
@@ -40,23 +55,13 @@ private:
 };
 
 /**
- * Exception used to re-synchronize when breaking out of loops
+ * How a statement finished executing. Return and break
+ * are propagated as ordinary values instead of exceptions
  */
-class BreakException : public std::exception {
-public:
-    BreakException() = default;
-};
-
-/**
- * Exception used to re-synchronize when returning from functions
- */
-class ReturnException : public std::exception {
-public:
-    explicit ReturnException(LoxType  value);
-
-    [[nodiscard]] const LoxType& getValue() const;
-private:
-    LoxType value_;
+enum class Completion {
+    NORMAL,
+    BREAK,
+    RETURN
 };
 
 /**
@@ -80,14 +85,16 @@ public:
     /*!
      * Interpret lox program
      * @param program sequence of statements
+     * @param slot_count registers needed by locals of the top-level code, computed by the resolver
      * @param context interpreter context for error reporting
      */
-    void interpret(std::vector<std::shared_ptr<Statement>>& program,
+    void interpret(std::vector<AstPtr<Statement>>& program,
+                   std::size_t slot_count,
                    const std::shared_ptr<LoxInterpreter>& context);
 
     /*!
      * Evaluate a Lox expression
-     * @param expr Expression to be evaluated
+     * @param expr Expression to be evaluated, its value is left on top of the value stack
      * @return Returned value, a Lox type (double, bool, null or string)
      */
     LoxType evaluate(Expression& expr);
@@ -95,33 +102,75 @@ public:
     /*!
      * Execute a lox statement
      * @param statement statement to execute
+     * @return how the statement completed, e.g. by a return or break
+     */
+    Completion execute(Statement& statement);
+
+    ~Interpreter() override;
+
+    /**
+     * Select the engine used by interpret
+     * @param engine engine to use for programs
+     */
+    void setEngine(Engine engine);
+
+    /**
+     * Select how numbers are converted to text by print and string concatenation
+     * @param format text representation of numbers
+     */
+    void setNumberFormat(NumberFormat format);
+
+    /**
+     * Redirect the output of print statements
+     * @param ostream stream to write to, not owned
+     */
+    void setOutputStream(std::ostream* ostream);
+
+    /**
+     * Write output of print statements that is still buffered, used by the flush native
      */
-    void execute(Statement& statement);
+    void flushOutput();
 
-    ~Interpreter() override = default;
+    /**
+     * Get the bytecode VM, used to call compiled functions
+     * @return reference to VM
+     */
+    VM& getVM();
 
     /**
-     * Get current environment
-     * @return reference to current environment
+     * Get garbage collected heap holding all runtime objects
+     * @return reference to heap
      */
-    [[nodiscard]] const std::shared_ptr<Environment>& getEnvironment() const;
+    Heap& getHeap();
 
     /**
-     * Execute block of statements, e.g. in a function
+     * Run a collection, marking the roots of the tree-walker and the VM
+     */
+    void collectGarbage();
+
+    /**
+     * Execute block of statements, e.g. in a function.
+     * Its locals are already placed in registers by the resolver
      * @param statements reference to block of statements
-     * @param new_environment new environment to use for block
+     * @return completion of the block, stops at the first return or break
      */
-    void executeBlock(const std::vector<std::shared_ptr<Statement>>& statements,
-                      std::shared_ptr<Environment> new_environment);
+    Completion executeBlock(const std::vector<AstPtr<Statement>>& statements);
 
     /**
-     * During resolve pass, this tells the interpreter where to look for
-     * local variables
-     * @param expr location in AST
-     * @param location location in scope array
-     * @param depth distance from current scope for lookup
+     * Run body of a function in a new register frame
+     * @param function function to run
+     * @param receiver value of this for methods
+     * @param arguments call arguments, copied into the parameter registers before the body runs
+     * @return returned value, nil if there was no return
      */
-    void resolve(Expression* expr, std::size_t location, std::size_t depth);
+    LoxType callFunction(LoxFunction* function, LoxInstance* receiver, Arguments arguments);
+
+    /**
+     * Take value of the last executed return statement and reset completion,
+     * used by functions after their body finished
+     * @return returned value, nil if there was no return
+     */
+    LoxType takeReturnValue();
 
     /**
      * Assign value to global variable, which will be placed into globals array
@@ -129,16 +178,38 @@ public:
      * @param value value to initialize global to
      */
     void defineGlobal(LoxType value);
+
+    /**
+     * Get hit counters of the inline caches of property accesses
+     * @return counters for both engines
+     */
+    [[nodiscard]] const InlineCacheStats& getCacheStats() const;
 private:
+    Heap heap_;
+
+    // Roots of the collector, together with the state of the VM
     std::vector<LoxType> valueStack_;
-    std::shared_ptr<Environment> globals_;
-    std::shared_ptr<Environment> environment_;
+    Environment* globals_;
 
-    // Location of local variables, associates AST tree location with location in scope relative
-    // to current scope
-    std::unordered_map<Expression*, std::pair<std::size_t, std::size_t>> exprLocations_;
+    // Registers of all active calls, the current call's start at frameBase_
+    std::vector<LoxType> registers_;
+    std::size_t frameBase_ = 0;
+    LoxFunction* currentFunction_ = nullptr; // Provides the upvalues, null in top-level code
 
     std::ostream* outputStream_;
+    NumberFormat numberFormat_ = NumberFormat::FIXED;
+
+    // Completion of the last executed statement and the value of a pending return
+    Completion completion_ = Completion::NORMAL;
+    LoxType returnValue_;
+
+    InlineCacheStats cacheStats_;
+
+    Engine engine_ = Engine::TREE_WALKER;
+    std::unique_ptr<VM> vm_;
+
+    // The VM shares globals, output and value semantics with the tree-walker
+    friend class VM;
 
     void visitBinary(Binary &b) override;
     void visitTernary(Ternary &t) override;
@@ -172,7 +243,22 @@ private:
     [[nodiscard]] static bool isEqual(const LoxType& t1, const LoxType& t2);
 
     static void checkNumberOperands(const Token& op, const LoxType& t1, const LoxType& t2);
-    LoxType lookUpVariable(Expression* expr);
+    // Addition of numbers and concatenation of strings, shared with the VM
+    LoxType add(const Token& op, const LoxType& left, const LoxType& right);
+    LoxString* concatenate(LoxString* left, LoxString* right);
+    LoxString* concatenate(std::string_view left, std::string_view right);
+    [[nodiscard]] const LoxType& lookUpVariable(const VariableLocation& location) const;
+    void assignVariable(const VariableLocation& location, LoxType value);
+    void defineVariable(const VariableLocation& location, LoxType value);
+    LoxFunction* makeClosure(const FunctionPrototype& prototype, FunctionKind kind);
+    void markRoots();
+
+    // Property lookups through the inline cache of the accessing site, shared with the VM
+    LoxType getProperty(LoxInstance* instance, const Token& name, PropertyCache& cache);
+    // Returns the method without binding it, or null and the value of the field
+    LoxFunction* lookUpProperty(LoxInstance* instance, const Token& name, PropertyCache& cache, LoxType& field);
+    void setProperty(LoxInstance* instance, const Token& name, LoxType value, PropertyCache& cache);
+    LoxFunction* getSuperMethod(LoxClass* superclass, const Token& name, PropertyCache& cache);
 };
 
 
@@ -8,9 +8,9 @@
 #include "interpreter.h"
 #include "resolver.h"
 
-#include <fstream>
 #include <string>
 #include <iostream>
+#include <unistd.h>
 
 LoxInterpreter::LoxInterpreter()
 : interpreter_{std::make_shared<Interpreter>()}, outputStream_{&std::cout}, errorStream_{&std::cerr}
@@ -26,17 +26,64 @@ LoxInterpreter::LoxInterpreter(std::ostream *output_stream, std::ostream *error_
 }
 
 
+void LoxInterpreter::setEngine(Engine engine) {
+    interpreter_->setEngine(engine);
+}
+
+void LoxInterpreter::enableBufferedOutput() {
+    if (outputBuffer_) { return; }
+
+    outputStream_->flush();
+    outputBuffer_ = std::make_unique<FileOutputBuffer>(STDOUT_FILENO);
+    bufferedStream_ = std::make_unique<std::ostream>(outputBuffer_.get());
+    outputStream_ = bufferedStream_.get();
+    interpreter_->setOutputStream(outputStream_);
+}
+
+void LoxInterpreter::setNumberFormat(NumberFormat format) {
+    numberFormat_ = format;
+    interpreter_->setNumberFormat(format);
+}
+
+void LoxInterpreter::configureHeap(std::size_t threshold, double growth_factor) {
+    interpreter_->getHeap().setThreshold(threshold);
+    interpreter_->getHeap().setGrowthFactor(growth_factor);
+}
+
+void LoxInterpreter::setParseThreads(unsigned threads) {
+    parseThreads_ = std::max(threads, 1u);
+}
+
+void LoxInterpreter::setGcStats(bool enable) {
+    gcStats_ = enable;
+}
+
+void LoxInterpreter::setCacheStats(bool enable) {
+    cacheStats_ = enable;
+}
+
+const Heap& LoxInterpreter::getHeap() const {
+    return interpreter_->getHeap();
+}
+
+Heap& LoxInterpreter::getHeap() {
+    return interpreter_->getHeap();
+}
+
+const InlineCacheStats& LoxInterpreter::getCacheStats() const {
+    return interpreter_->getCacheStats();
+}
+
 void LoxInterpreter::runFile(const char* filename) {
-    std::ifstream ifs{filename};
-    if (!ifs.good()) { // We have to check if the stream could be opened
+    std::shared_ptr<const SourceBuffer> source = SourceBuffer::fromFile(filename);
+    if (!source) {
         *errorStream_ << "File " << filename << " could not be opened" << std::endl;
         std::exit(64);
     }
 
-    // Read file into string
-    auto source = std::make_unique<std::string>(std::istreambuf_iterator<char>(ifs),
-                                                std::istreambuf_iterator<char>());
     run(std::move(source), false);
+    outputStream_->flush();
+    reportStats();
 
     if (hadError_) {
         if (!testMode_) {
@@ -57,16 +104,17 @@ void LoxInterpreter::runPrompt() {
     while (std::cin) {
         std::cout << "> "; // Prompt character
         std::getline(std::cin, input_line);
-        run(std::make_unique<std::string>(input_line), true);
+        run(std::make_shared<const SourceBuffer>(input_line), true);
+        outputStream_->flush();
         hadError_ = false;
     }
+    reportStats();
 }
 
-void LoxInterpreter::run(std::unique_ptr<std::string> source, bool repl_mode) {
-    Scanner scanner{std::move(source), shared_from_this()};
-    scanner.scanTokens();
-    auto tokens = scanner.getTokens();
-    Parser parser{tokens, shared_from_this()};
+void LoxInterpreter::run(std::shared_ptr<const SourceBuffer> source, bool repl_mode) {
+    // Declared first, nodes that are not kept are destroyed before it
+    auto arena = std::make_unique<AstArena>();
+    Parser parser{Scanner{source, shared_from_this()}, *arena, shared_from_this()};
 
     if (repl_mode) {
 
@@ -77,17 +125,22 @@ void LoxInterpreter::run(std::unique_ptr<std::string> source, bool repl_mode) {
         if (!hadError_) {
             try {
                 auto result = interpreter_->evaluate(*expression);
-                std::cout << stringify(result) << std::endl;
+                *outputStream_ << stringify(result, numberFormat_) << '\n';
             } catch (const RuntimeError &error) {
                 runtimeError(error);
             }
 
+            // Tokens in the kept nodes refer to the source
+            expressions_.push_back(std::move(expression));
+            arenas_.push_back(std::move(arena));
+            sources_.push_back(std::move(source));
             return;
         }
         parser.reset();
         hadError_ = false;
     }
 
+    parser.setThreads(parseThreads_);
     auto program = parser.parse();
     if (hadError_) { return; }
 
@@ -96,8 +149,11 @@ void LoxInterpreter::run(std::unique_ptr<std::string> source, bool repl_mode) {
 
     if (hadError_) { return; }
 
+    programs_.push_back(std::move(program));
+    arenas_.push_back(std::move(arena));
+    sources_.push_back(std::move(source));
     try {
-        interpreter_->interpret(program, shared_from_this());
+        interpreter_->interpret(programs_.back(), resolver.getScriptSlotCount(), shared_from_this());
     } catch (const RuntimeError& error) {
         runtimeError(error);
     }
@@ -118,15 +174,32 @@ void LoxInterpreter::error(const Token& token, std::string_view message) {
     if (token.getType() == TokenType::EOF_TYPE) {
         reportError(token.getLine(), " at end", message);
     } else {
-        reportError(token.getLine(), "at '" + token.getLexeme() + "'", message);
+        reportError(token.getLine(), "at '" + std::string{token.getLexeme()} + "'", message);
     }
 }
 
 void LoxInterpreter::runtimeError(const RuntimeError& e) {
+    // Output printed before the error has to appear before it
+    outputStream_->flush();
     *errorStream_ << "[" << e.what() << " line " << e.getToken().getLine() << "]\n";
     hadRuntimeError_ = true;
 }
 
+void LoxInterpreter::reportStats() {
+    if (gcStats_) {
+        interpreter_->getHeap().printStats(*errorStream_);
+    }
+
+    if (cacheStats_) {
+        const auto& stats = interpreter_->getCacheStats();
+        const auto lookups = stats.hits + stats.misses;
+        const double hit_rate = lookups ? 100.0 * static_cast<double>(stats.hits) / static_cast<double>(lookups) : 0.0;
+        *errorStream_ << "[ic] property lookups: " << lookups
+                      << ", hits: " << stats.hits << " (" << hit_rate << "%)"
+                      << ", misses: " << stats.misses << '\n';
+    }
+}
+
 void LoxInterpreter::enableParseErrorReporting() {
     silentParseErrors_ = false;
 }
@@ -10,12 +10,16 @@
 #ifndef LOX_LOX_H
 #define LOX_LOX_H
 
+#include <algorithm>
 #include <memory>
+#include <thread>
 #include <ostream>
 
 #include "token.h"
 #include "types.h"
 #include "interpreter.h"
+#include "output_buffer.h"
+#include "source_buffer.h"
 
 /*!
  * Class representing the context of the lox interpreter
@@ -36,6 +40,64 @@ public:
      */
     LoxInterpreter(std::ostream* output_stream, std::ostream* error_stream, bool test_mode = true);
 
+    /*!
+     * Select execution engine for programs
+     * @param engine tree-walker or bytecode VM
+     */
+    void setEngine(Engine engine);
+
+    /*!
+     * Select how numbers are printed and appended to strings
+     * @param format fixed six decimals, the default, or shortest round-trip text
+     */
+    void setNumberFormat(NumberFormat format);
+
+    /*!
+     * Write the output of print statements to stdout through a large buffer
+     * instead of the output stream. Buffered output is written when the buffer is full,
+     * after running a script or REPL line, before runtime errors and by flush()
+     */
+    void enableBufferedOutput();
+
+    /*!
+     * Set number of threads used to parse large scripts
+     * @param threads number of threads, 1 parses on the main thread only
+     */
+    void setParseThreads(unsigned threads);
+
+    /*!
+     * Configure when the garbage collector runs
+     * @param threshold minimum heap size in bytes that triggers a collection
+     * @param growth_factor heap growth relative to the live data after a collection
+     * that triggers the next one
+     */
+    void configureHeap(std::size_t threshold, double growth_factor);
+
+    /*!
+     * Print garbage collector statistics to the error stream after running a script
+     * @param enable whether to print statistics
+     */
+    void setGcStats(bool enable);
+
+    /*!
+     * Print hit rate of the property inline caches to the error stream after running a script
+     * @param enable whether to print statistics
+     */
+    void setCacheStats(bool enable);
+
+    /*!
+     * Get garbage collected heap of the interpreter
+     * @return reference to heap
+     */
+    [[nodiscard]] const Heap& getHeap() const;
+    [[nodiscard]] Heap& getHeap();
+
+    /*!
+     * Get hit counters of the property inline caches
+     * @return reference to counters
+     */
+    [[nodiscard]] const InlineCacheStats& getCacheStats() const;
+
     /*!
      * Run file containing lox commands
      * @param filename C-Style string containing the file name of the script to be run
@@ -52,7 +114,7 @@ public:
      * does the requisite steps and then runs it
      * @param source fragment of source code to run
      */
-    void run(std::unique_ptr<std::string> source, bool repl_mode);
+    void run(std::shared_ptr<const SourceBuffer> source, bool repl_mode);
 
     /*!
      * Report an error in a certain line
@@ -77,13 +139,29 @@ private:
     bool hadError_ = false;
     bool hadRuntimeError_ = false;
     bool silentParseErrors_ = false;
+    bool gcStats_ = false;
+    bool cacheStats_ = false;
+    NumberFormat numberFormat_ = NumberFormat::FIXED;
+    unsigned parseThreads_ = std::max(std::thread::hardware_concurrency(), 1u);
     std::shared_ptr<Interpreter> interpreter_;
 
+    // Runtime values may refer to string literals and function bodies in the AST,
+    // so everything that was run stays alive as long as the interpreter.
+    // Tokens are views into the source, which is kept for the same reason.
+    // The arenas hold the memory of the nodes and are released after them
+    std::vector<std::shared_ptr<const SourceBuffer>> sources_;
+    std::vector<std::unique_ptr<AstArena>> arenas_;
+    std::vector<std::vector<AstPtr<Statement>>> programs_;
+    std::vector<AstPtr<Expression>> expressions_;
+
     std::ostream* outputStream_;
     std::ostream* errorStream_;
+    std::unique_ptr<FileOutputBuffer> outputBuffer_;
+    std::unique_ptr<std::ostream> bufferedStream_;
     bool testMode_ = false;
 
     void reportError(int line, std::string_view where, std::string_view message);
+    void reportStats();
 
     // For REPL functionality, we sometimes need to disable parse error reporting
     void enableParseErrorReporting();
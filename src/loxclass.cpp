@@ -5,29 +5,34 @@
 #include "loxclass.h"
 #include "loxinstance.h"
 #include "loxfunction.h"
+#include "interpreter.h"
 
 #include <utility>
 
-LoxClass::LoxClass(std::string name, std::unordered_map<Token, std::shared_ptr<LoxFunction>> methods)
-    : name_{std::move(name)}, methods_(std::move(methods)), superclass_(nullptr)
+LoxClass::LoxClass(std::string name, std::unordered_map<Token, LoxFunction*> methods)
+    : Callable(ObjType::CLASS), name_{std::move(name)}, methods_(std::move(methods)), superclass_(nullptr),
+      rootShape_(std::make_unique<Shape>())
 {
 }
 
-LoxClass::LoxClass(std::string name, std::unordered_map<Token, std::shared_ptr<LoxFunction>> methods,
-                   std::shared_ptr<LoxClass> superclass)
-        : name_{std::move(name)}, methods_(std::move(methods)), superclass_(std::move(superclass))
+LoxClass::LoxClass(std::string name, std::unordered_map<Token, LoxFunction*> methods,
+                   LoxClass* superclass)
+        : Callable(ObjType::CLASS), name_{std::move(name)}, methods_(std::move(methods)),
+          superclass_(superclass), rootShape_(std::make_unique<Shape>())
 {
 }
 
+LoxClass::~LoxClass() = default;
+
 const std::string& LoxClass::getName() const {
     return name_;
 }
 
-LoxType LoxClass::call(Interpreter& interpreter, std::vector<LoxType>& arguments) {
-    std::shared_ptr<LoxInstance> new_instance = std::make_shared<LoxInstance>(shared_from_this());
+LoxType LoxClass::call(Interpreter& interpreter, Arguments arguments) {
+    auto* new_instance = interpreter.getHeap().allocate<LoxInstance>(this);
     auto initializer = getMethod(Token(TokenType::IDENTIFIER, "init", 0));
     if (initializer) {
-        initializer->bind(new_instance)->call(interpreter, arguments);
+        initializer->callMethod(interpreter, new_instance, arguments);
     }
     return new_instance;
 }
@@ -38,14 +43,26 @@ int LoxClass::arity() {
     else { return 0; }
 }
 
-std::shared_ptr<LoxFunction> LoxClass::getMethod(const Token& name) {
-    if (methods_.count(name)) {
-        return methods_.at(name);
+LoxFunction* LoxClass::getMethod(const Token& name) {
+    auto it = methods_.find(name);
+    if (it != methods_.end()) {
+        return it->second;
     }
 
     if (superclass_) {
         return superclass_->getMethod(name);
     }
 
-    return {};
+    return nullptr;
+}
+
+Shape* LoxClass::getRootShape() {
+    return rootShape_.get();
+}
+
+void LoxClass::trace(Heap& heap) {
+    for (const auto& [name, method] : methods_) {
+        heap.markObject(method);
+    }
+    heap.markObject(superclass_);
 }
@@ -9,32 +9,42 @@
 #include <unordered_map>
 
 #include "types.h"
+#include "shape.h"
 
 class LoxFunction;
 
-class LoxClass : public Callable, public std::enable_shared_from_this<LoxClass> {
+class LoxClass : public Callable {
 public:
     LoxClass(std::string name,
-             std::unordered_map<Token, std::shared_ptr<LoxFunction>> methods);
+             std::unordered_map<Token, LoxFunction*> methods);
 
     LoxClass(std::string name,
-             std::unordered_map<Token, std::shared_ptr<LoxFunction>> methods,
-             std::shared_ptr<LoxClass> superclass);
+             std::unordered_map<Token, LoxFunction*> methods,
+             LoxClass* superclass);
 
     const std::string& getName() const;
 
-    std::shared_ptr<LoxFunction> getMethod(const Token& name);
+    LoxFunction* getMethod(const Token& name);
 
-    LoxType call(Interpreter& interpreter, std::vector<LoxType>& arguments) override;
+    /**
+     * Get shape of instances without fields, root of the shape tree of this class
+     * @return pointer to root shape, owned by the class
+     */
+    Shape* getRootShape();
+
+    LoxType call(Interpreter& interpreter, Arguments arguments) override;
 
     int arity() override;
 
-    ~LoxClass() override = default;
+    void trace(Heap& heap) override;
+
+    ~LoxClass() override;
 
 private:
     std::string name_;
-    std::unordered_map<Token, std::shared_ptr<LoxFunction>> methods_;
-    std::shared_ptr<LoxClass> superclass_;
+    std::unordered_map<Token, LoxFunction*> methods_;
+    LoxClass* superclass_;
+    std::unique_ptr<Shape> rootShape_;
 };
 
 
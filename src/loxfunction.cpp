@@ -6,54 +6,72 @@
 
 #include <utility>
 #include "interpreter.h"
+#include "loxinstance.h"
+#include "vm.h"
 
 
-LoxFunction::LoxFunction(Function& function, std::shared_ptr<Environment> closure, bool is_init)
-    : statements_(function.getBody()), params_(function.getParams()), closure_(std::move(closure)),
-      isInit_(is_init)
+LoxFunction::LoxFunction(const FunctionPrototype& prototype, std::vector<Upvalue*> upvalues, FunctionKind kind)
+    : Callable(ObjType::FUNCTION), prototype_(&prototype), upvalues_(std::move(upvalues)), kind_(kind)
 {}
 
-
-LoxFunction::LoxFunction(FunctionExpression &function, std::shared_ptr<Environment> closure, bool is_init)
-    : statements_(function.getBody()), params_(function.getParams()), closure_(std::move(closure)),
-      isInit_(is_init)
-{}
-
-LoxFunction::LoxFunction(std::vector<std::shared_ptr<Statement>> statements,
-                         std::vector<Token> params,
-                         std::shared_ptr<Environment> closure,
-                         bool is_init)
-     : statements_(std::move(statements)), params_(std::move(params)), closure_(std::move(closure)),
-       isInit_(is_init)
+LoxFunction::LoxFunction(std::shared_ptr<const FunctionCode> code, std::vector<Upvalue*> upvalues, FunctionKind kind)
+    : Callable(ObjType::FUNCTION), upvalues_(std::move(upvalues)), kind_(kind), code_(std::move(code))
 {}
 
-std::shared_ptr<LoxFunction> LoxFunction::bind(const std::shared_ptr<LoxInstance>& instance) {
-    std::shared_ptr<Environment> env = std::make_shared<Environment>();
-    env->setEnclosing(closure_);
-    env->define(instance);
-    return std::make_shared<LoxFunction>(statements_, params_, env, isInit_);
+LoxFunction* LoxFunction::bind(LoxInstance* instance, Heap& heap) {
+    LoxFunction* bound;
+    if (code_) {
+        bound = heap.allocate<LoxFunction>(code_, upvalues_, kind_);
+    } else {
+        bound = heap.allocate<LoxFunction>(*prototype_, upvalues_, kind_);
+    }
+    bound->receiver_ = instance;
+    return bound;
 }
 
-LoxType LoxFunction::call(Interpreter& interpreter, std::vector<LoxType>& arguments) {
-    std::shared_ptr<Environment> environment = std::make_shared<Environment>();
-    environment->setEnclosing(closure_);
+LoxType LoxFunction::call(Interpreter& interpreter, Arguments arguments) {
+    return callMethod(interpreter, receiver_, arguments);
+}
 
-    for (int i = 0; i < params_.size(); ++i) {
-        environment->define(arguments[i]);
+LoxType LoxFunction::callMethod(Interpreter& interpreter, LoxInstance* receiver, Arguments arguments) {
+    if (code_) {
+        return interpreter.getVM().call(this, receiver, arguments);
     }
 
-    try {
-        interpreter.executeBlock(statements_, environment);
-    } catch (const ReturnException& r) {
-        if (isInit_) { return closure_->getAt(0, 0); }
-        return r.getValue();
-    }
+    LoxType return_value = interpreter.callFunction(this, receiver, arguments);
 
-    if (isInit_) { return closure_->getAt(0, 0); }
-    return NullType{};
+    if (isInitializer()) { return receiver; }
+    return return_value;
 }
 
 int LoxFunction::arity() {
-    return static_cast<int>(params_.size());
+    if (code_) { return code_->arity; }
+    return static_cast<int>(prototype_->params.size());
+}
+
+const std::shared_ptr<const FunctionCode>& LoxFunction::getCode() const {
+    return code_;
+}
+
+const FunctionPrototype& LoxFunction::getPrototype() const {
+    return *prototype_;
+}
+
+bool LoxFunction::isMethod() const {
+    return kind_ != FunctionKind::FUNCTION;
+}
+
+bool LoxFunction::isInitializer() const {
+    return kind_ == FunctionKind::INITIALIZER;
 }
 
+LoxInstance* LoxFunction::getReceiver() const {
+    return receiver_;
+}
+
+void LoxFunction::trace(Heap& heap) {
+    for (auto* upvalue : upvalues_) {
+        heap.markObject(upvalue);
+    }
+    heap.markObject(receiver_);
+}
@@ -8,7 +8,19 @@
 #include "types.h"
 #include "statements.h"
 #include "token.h"
-#include "environment.h"
+#include "upvalue.h"
+#include "chunk.h"
+
+class LoxInstance;
+
+/**
+ * Kinds of functions. Methods receive "this" in the first register of their call
+ */
+enum class FunctionKind {
+    FUNCTION,
+    METHOD,
+    INITIALIZER
+};
 
 /**
  * This represents user-defined functions in Lox
@@ -16,38 +28,85 @@
 class LoxFunction : public Callable {
 public:
     /**
-     * Constructor used for normal functions
-     * @param function Reference to normal function in AST
-     * @param closure enclosing environment used for lookups
+     * Constructor used for functions run by the tree-walker
+     * @param prototype parameters and body, owned by the AST which outlives the function
+     * @param upvalues captured variables, in the order of the prototype's upvalue descriptors
+     * @param kind whether the function is a method
      */
-    LoxFunction(Function& function, std::shared_ptr<Environment> closure, bool is_init);
+    LoxFunction(const FunctionPrototype& prototype, std::vector<Upvalue*> upvalues, FunctionKind kind);
 
     /**
-     * Constructor used for anonymous functions
-     * @param function Reference to anonymous function
-     * @param closure enclosing environment used for lookups
+     * Constructor used for functions compiled to bytecode
+     * @param code compiled function body
+     * @param upvalues captured variables, in the order of the code's upvalue descriptors
+     * @param kind whether the function is a method
      */
-    LoxFunction(FunctionExpression& function, std::shared_ptr<Environment> closure, bool is_init);
+    LoxFunction(std::shared_ptr<const FunctionCode> code, std::vector<Upvalue*> upvalues, FunctionKind kind);
 
-    LoxFunction(std::vector<std::shared_ptr<Statement>>  statements_,
-                std::vector<Token>  params_,
-                std::shared_ptr<Environment> closure_,
-                bool is_init);
+    /**
+     * Create method bound to an instance, only needed when the method
+     * is used as a value instead of being called right away
+     * @param instance value of this in the method
+     * @param heap heap to allocate the bound method on
+     * @return new function remembering the instance
+     */
+    LoxFunction* bind(LoxInstance* instance, Heap& heap);
 
-    std::shared_ptr<LoxFunction> bind(const std::shared_ptr<LoxInstance>& instance);
+    LoxType call(Interpreter &interpreter, Arguments arguments) override;
 
-    LoxType call(Interpreter &interpreter, std::vector<LoxType> &arguments) override;
+    /**
+     * Call method with an explicit receiver, without binding it first
+     * @param interpreter interpreter running the body
+     * @param receiver value of this
+     * @param arguments call arguments
+     * @return return value, the receiver for initializers
+     */
+    LoxType callMethod(Interpreter& interpreter, LoxInstance* receiver, Arguments arguments);
 
     int arity() override;
 
+    /**
+     * Get compiled body
+     * @return compiled body, empty if the function is run by the tree-walker
+     */
+    [[nodiscard]] const std::shared_ptr<const FunctionCode>& getCode() const;
+
+    /**
+     * Get parameters and body
+     * @return prototype, only valid if the function is run by the tree-walker
+     */
+    [[nodiscard]] const FunctionPrototype& getPrototype() const;
+
+    /**
+     * Get captured variable
+     * @param index index from the resolver's upvalue location
+     * @return cell holding the variable
+     */
+    [[nodiscard]] Upvalue* getUpvalue(std::size_t index) const { return upvalues_[index]; }
+
+    [[nodiscard]] bool isMethod() const;
+
+    [[nodiscard]] bool isInitializer() const;
+
+    /**
+     * Get instance a method is bound to
+     * @return receiver, null for functions and unbound methods
+     */
+    [[nodiscard]] LoxInstance* getReceiver() const;
+
+    void trace(Heap& heap) override;
+
+    [[nodiscard]] std::size_t payloadSize() const override { return upvalues_.capacity() * sizeof(Upvalue*); }
+
     ~LoxFunction() override = default;
 
 
 private:
-    std::vector<std::shared_ptr<Statement>> statements_;
-    std::vector<Token> params_;
-    std::shared_ptr<Environment> closure_;
-    bool isInit_;
+    const FunctionPrototype* prototype_ = nullptr;
+    std::vector<Upvalue*> upvalues_;
+    FunctionKind kind_;
+    LoxInstance* receiver_ = nullptr;
+    std::shared_ptr<const FunctionCode> code_;
 };
 
 
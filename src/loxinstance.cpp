@@ -3,31 +3,28 @@
 //
 
 #include "loxinstance.h"
-#include "loxfunction.h"
-#include "interpreter.h"
+#include "heap.h"
 
-#include <utility>
-
-LoxInstance::LoxInstance(std::shared_ptr<LoxClass> klass) : class_{std::move(klass)}
+LoxInstance::LoxInstance(LoxClass* klass) : Obj(ObjType::INSTANCE), class_{klass}, shape_{klass->getRootShape()}
 {}
 
-const std::shared_ptr<LoxClass>& LoxInstance::getClass() const {
+LoxClass* LoxInstance::getClass() const {
     return class_;
 }
 
-LoxType LoxInstance::get(const Token& name) {
-    if (fields_.count(name)) {
-        return fields_.at(name);
-    }
-
-    if (class_->getMethod(name)) {
-        return class_->getMethod(name)->bind(shared_from_this());
-    }
+Shape* LoxInstance::getShape() const {
+    return shape_;
+}
 
-    throw RuntimeError(name,
-                       "Undefined property '" + name.getLexeme() + "'.");
+void LoxInstance::addField(Heap& heap, Shape* shape, LoxType value) {
+    shape_ = shape;
+    slots_.push_back(value);
+    heap.updatePayload(this);
 }
 
-void LoxInstance::set(const Token& name, LoxType value) {
-    fields_[name] = std::move(value);
+void LoxInstance::trace(Heap& heap) {
+    heap.markObject(class_);
+    for (const auto& value : slots_) {
+        heap.markValue(value);
+    }
 }
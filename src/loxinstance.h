@@ -5,23 +5,58 @@
 #ifndef LOX_LOXINSTANCE_H
 #define LOX_LOXINSTANCE_H
 
-#include <unordered_map>
+#include <vector>
 
 #include "loxclass.h"
+#include "shape.h"
 
-class LoxInstance : public std::enable_shared_from_this<LoxInstance> {
+class LoxInstance : public Obj {
 public:
-    explicit LoxInstance(std::shared_ptr<LoxClass> klass);
-
-    [[nodiscard]] const std::shared_ptr<LoxClass>& getClass() const;
-
-    LoxType get(const Token& name);
-
-    void set(const Token& name, LoxType value);
+    explicit LoxInstance(LoxClass* klass);
+
+    [[nodiscard]] LoxClass* getClass() const;
+
+    /**
+     * Get shape describing the layout of the fields
+     * @return pointer to shape, owned by the class
+     */
+    [[nodiscard]] Shape* getShape() const;
+
+    /**
+     * Get value of field
+     * @param slot slot of the field in the current shape
+     * @return value of the field
+     */
+    [[nodiscard]] const LoxType& getSlot(std::size_t slot) const {
+        return slots_[slot];
+    }
+
+    /**
+     * Overwrite value of existing field
+     * @param slot slot of the field in the current shape
+     * @param value new value
+     */
+    void setSlot(std::size_t slot, LoxType value) {
+        slots_[slot] = value;
+    }
+
+    /**
+     * Add new field, which occupies the last slot of the new shape
+     * @param heap heap owning the instance, accounts for the grown slots
+     * @param shape transition of the current shape for the field
+     * @param value value of the field
+     */
+    void addField(Heap& heap, Shape* shape, LoxType value);
+
+    void trace(Heap& heap) override;
+
+    [[nodiscard]] std::size_t payloadSize() const override { return slots_.capacity() * sizeof(LoxType); }
 private:
-    std::shared_ptr<LoxClass> class_;
+    LoxClass* class_;
 
-    std::unordered_map<Token, LoxType> fields_;
+    // Field values, in the slots given by the shape
+    Shape* shape_;
+    std::vector<LoxType> slots_;
 };
 
 
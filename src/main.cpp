@@ -1,5 +1,7 @@
 #include <iostream>
 #include <memory>
+#include <string>
+#include <string_view>
 
 #include "lox.h"
 #include "types.h"
@@ -7,11 +9,43 @@
 int main(int argc, const char *argv[]) {
     std::shared_ptr<LoxInterpreter> interpreter = std::make_shared<LoxInterpreter>();
 
+    std::size_t gc_threshold = 1024 * 1024;
+    double gc_growth_factor = 2.0;
+
     // Remember: First arg is program name
-    if (argc > 2) {
-        std::cout << "Usage: cpplox [script]";
-    } else if (argc == 2) {
-        interpreter->runFile(argv[1]);
+    int first_arg = 1;
+    for (; first_arg < argc; ++first_arg) {
+        std::string_view arg{argv[first_arg]};
+        if (arg == "--engine=vm") {
+            interpreter->setEngine(Engine::BYTECODE_VM);
+        } else if (arg == "--engine=ast") {
+            interpreter->setEngine(Engine::TREE_WALKER);
+        } else if (arg == "--number-format=fixed") {
+            interpreter->setNumberFormat(NumberFormat::FIXED);
+        } else if (arg == "--number-format=shortest") {
+            interpreter->setNumberFormat(NumberFormat::SHORTEST);
+        } else if (arg == "--buffered-output") {
+            interpreter->enableBufferedOutput();
+        } else if (arg == "--gc-stats") {
+            interpreter->setGcStats(true);
+        } else if (arg == "--ic-stats") {
+            interpreter->setCacheStats(true);
+        } else if (arg.substr(0, 15) == "--gc-threshold=") {
+            gc_threshold = std::stoul(std::string{arg.substr(15)});
+        } else if (arg.substr(0, 16) == "--parse-threads=") {
+            interpreter->setParseThreads(std::stoul(std::string{arg.substr(16)}));
+        } else if (arg.substr(0, 12) == "--gc-growth=") {
+            gc_growth_factor = std::stod(std::string{arg.substr(12)});
+        } else {
+            break;
+        }
+    }
+    interpreter->configureHeap(gc_threshold, gc_growth_factor);
+
+    if (argc - first_arg > 1) {
+        std::cout << "Usage: cpplox [--engine=ast|vm] [--number-format=fixed|shortest] [--buffered-output] [--gc-stats] [--gc-threshold=bytes] [--gc-growth=factor] [--ic-stats] [--parse-threads=n] [script]";
+    } else if (argc - first_arg == 1) {
+        interpreter->runFile(argv[first_arg]);
     } else {
         interpreter->runPrompt();
     }
@@ -6,11 +6,11 @@
 
 #include <chrono>
 
-Clock::Clock(bool test_mode) : testMode_(test_mode) {
+Clock::Clock(bool test_mode) : Callable(ObjType::NATIVE), testMode_(test_mode) {
 
 }
 
-LoxType Clock::call(Interpreter &interpreter, std::vector<LoxType> &arguments) {
+LoxType Clock::call(Interpreter &interpreter, Arguments arguments) {
     if (testMode_) { return 0.0; }
     double now = static_cast<double>(std::chrono::duration_cast<std::chrono::milliseconds>
             (std::chrono::system_clock::now().time_since_epoch()).count());
@@ -18,7 +18,7 @@ public:
      */
     explicit Clock(bool test_mode);
 
-    LoxType call(Interpreter &interpreter, std::vector<LoxType> &arguments) override;
+    LoxType call(Interpreter &interpreter, Arguments arguments) override;
 
     int arity() override;
 
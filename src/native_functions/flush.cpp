@@ -0,0 +1,18 @@
+#include "flush.h"
+#include "interpreter.h"
+
+Flush::Flush() : Callable(ObjType::NATIVE) {
+
+}
+
+LoxType Flush::call(Interpreter &interpreter, Arguments) {
+    interpreter.flushOutput();
+    return NullType{};
+}
+
+int Flush::arity() {
+    return 0;
+}
+
+
+Flush::~Flush() = default;
@@ -0,0 +1,21 @@
+#ifndef LOX_FLUSH_H
+#define LOX_FLUSH_H
+
+#include "types.h"
+
+/**
+ * Native function - writes buffered output of print statements
+ */
+class Flush : public Callable {
+public:
+    Flush();
+
+    LoxType call(Interpreter &interpreter, Arguments arguments) override;
+
+    int arity() override;
+
+    ~Flush() override;
+};
+
+
+#endif //LOX_FLUSH_H
@@ -0,0 +1,42 @@
+#include "object_pool.h"
+
+#include <new>
+
+ObjectPool::~ObjectPool() {
+    for (std::size_t i = 0; i < CLASSES; ++i) {
+        while (freeLists_[i]) {
+            FreeBlock* next = freeLists_[i]->next;
+            ::operator delete(freeLists_[i]);
+            freeLists_[i] = next;
+        }
+    }
+}
+
+void* ObjectPool::allocate(std::size_t size) {
+    if (size == 0 || size > MAX_SIZE) {
+        return ::operator new(size);
+    }
+
+    const auto size_class = sizeClass(size);
+    FreeBlock* block = freeLists_[size_class];
+    if (!block) {
+        return ::operator new(classSize(size_class));
+    }
+
+    freeLists_[size_class] = block->next;
+    pooledBytes_ -= classSize(size_class);
+    reused_++;
+    return block;
+}
+
+void ObjectPool::release(void* memory, std::size_t size) {
+    if (size == 0 || size > MAX_SIZE || pooledBytes_ + classSize(sizeClass(size)) > LIMIT) {
+        ::operator delete(memory);
+        return;
+    }
+
+    const auto size_class = sizeClass(size);
+    auto* block = new(memory) FreeBlock{freeLists_[size_class]};
+    freeLists_[size_class] = block;
+    pooledBytes_ += classSize(size_class);
+}
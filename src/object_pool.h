@@ -0,0 +1,80 @@
+#ifndef LOX_OBJECT_POOL_H
+#define LOX_OBJECT_POOL_H
+
+#include <array>
+#include <cstddef>
+
+/*!
+ * Free lists for the memory of small heap objects.
+ * Blocks are grouped into size classes of ALIGNMENT bytes. Freed blocks
+ * are kept on the list of their class and handed out again by the next
+ * allocation of that class, so objects created and dropped on every call,
+ * like closures and upvalue cells, reuse memory instead of going through
+ * malloc. The pool keeps at most LIMIT bytes; blocks beyond that and
+ * blocks larger than the biggest class go back to the system.
+ */
+class ObjectPool {
+public:
+    constexpr static std::size_t ALIGNMENT = 16;
+    constexpr static std::size_t MAX_SIZE = 256;
+    constexpr static std::size_t LIMIT = 4 * 1024 * 1024;
+
+    ObjectPool() = default;
+
+    ObjectPool(const ObjectPool&) = delete;
+    ObjectPool& operator=(const ObjectPool&) = delete;
+
+    /**
+     * Returns all pooled blocks to the system
+     */
+    ~ObjectPool();
+
+    /**
+     * Get memory for an object
+     * @param size size of the object in bytes
+     * @return block of at least size bytes, suitably aligned for any object
+     */
+    void* allocate(std::size_t size);
+
+    /**
+     * Give back memory of a destroyed object
+     * @param memory block returned by allocate
+     * @param size size passed to allocate
+     */
+    void release(void* memory, std::size_t size);
+
+    /**
+     * Get number of allocations served from a free list instead of the system
+     * @return number of reused blocks
+     */
+    [[nodiscard]] std::size_t getReused() const { return reused_; }
+
+    /**
+     * Get size of the blocks currently kept for reuse
+     * @return size in bytes
+     */
+    [[nodiscard]] std::size_t getPooledBytes() const { return pooledBytes_; }
+
+private:
+    // Free blocks store the link to the next one in their first bytes
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    constexpr static std::size_t CLASSES = MAX_SIZE / ALIGNMENT;
+
+    std::array<FreeBlock*, CLASSES> freeLists_{};
+    std::size_t pooledBytes_ = 0;
+    std::size_t reused_ = 0;
+
+    [[nodiscard]] static std::size_t classSize(std::size_t size_class) {
+        return (size_class + 1) * ALIGNMENT;
+    }
+
+    [[nodiscard]] static std::size_t sizeClass(std::size_t size) {
+        return (size - 1) / ALIGNMENT;
+    }
+};
+
+
+#endif //LOX_OBJECT_POOL_H
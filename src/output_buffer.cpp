@@ -0,0 +1,63 @@
+#include "output_buffer.h"
+
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+FileOutputBuffer::FileOutputBuffer(int fd, std::size_t size) : fd_{fd}, buffer_(size) {
+    setp(buffer_.data(), buffer_.data() + buffer_.size());
+}
+
+FileOutputBuffer::~FileOutputBuffer() {
+    flushBuffer();
+}
+
+FileOutputBuffer::int_type FileOutputBuffer::overflow(int_type ch) {
+    if (!flushBuffer()) { return traits_type::eof(); }
+    if (traits_type::eq_int_type(ch, traits_type::eof())) { return traits_type::not_eof(ch); }
+
+    *pptr() = traits_type::to_char_type(ch);
+    pbump(1);
+    return ch;
+}
+
+std::streamsize FileOutputBuffer::xsputn(const char* s, std::streamsize count) {
+    const auto size = static_cast<std::size_t>(count);
+    if (size <= static_cast<std::size_t>(epptr() - pptr())) {
+        std::memcpy(pptr(), s, size);
+        pbump(static_cast<int>(count));
+        return count;
+    }
+
+    // Output that does not fit is written right after the buffered part, large blocks skip the buffer
+    if (!flushBuffer()) { return 0; }
+    if (size >= buffer_.size()) {
+        return writeAll(s, size) ? count : 0;
+    }
+    std::memcpy(pptr(), s, size);
+    pbump(static_cast<int>(count));
+    return count;
+}
+
+int FileOutputBuffer::sync() {
+    return flushBuffer() ? 0 : -1;
+}
+
+bool FileOutputBuffer::flushBuffer() {
+    const auto count = static_cast<std::size_t>(pptr() - pbase());
+    setp(buffer_.data(), buffer_.data() + buffer_.size());
+    return writeAll(buffer_.data(), count);
+}
+
+bool FileOutputBuffer::writeAll(const char* data, std::size_t count) {
+    while (count > 0) {
+        const auto written = ::write(fd_, data, count);
+        if (written < 0) {
+            if (errno == EINTR) { continue; }
+            return false;
+        }
+        data += written;
+        count -= static_cast<std::size_t>(written);
+    }
+    return true;
+}
@@ -0,0 +1,48 @@
+#ifndef LOX_OUTPUT_BUFFER_H
+#define LOX_OUTPUT_BUFFER_H
+
+#include <cstddef>
+#include <streambuf>
+#include <vector>
+
+/*!
+ * Stream buffer collecting output in a large user-space buffer and writing it
+ * to a file descriptor with write(2). Used for the output of print statements
+ * with --buffered-output, which avoids the per-line flushing and locking of
+ * std::cout. The buffer is written when it is full, when the stream is flushed
+ * and when the buffer is destroyed.
+ */
+class FileOutputBuffer : public std::streambuf {
+public:
+    constexpr static std::size_t DEFAULT_SIZE = 64 * 1024;
+
+    /**
+     * Constructor
+     * @param fd file descriptor to write to, not owned
+     * @param size size of the buffer in bytes
+     */
+    explicit FileOutputBuffer(int fd, std::size_t size = DEFAULT_SIZE);
+
+    FileOutputBuffer(const FileOutputBuffer&) = delete;
+    FileOutputBuffer& operator=(const FileOutputBuffer&) = delete;
+
+    /**
+     * Writes remaining output
+     */
+    ~FileOutputBuffer() override;
+
+protected:
+    int_type overflow(int_type ch) override;
+    std::streamsize xsputn(const char* s, std::streamsize count) override;
+    int sync() override;
+
+private:
+    int fd_;
+    std::vector<char> buffer_;
+
+    bool flushBuffer();
+    bool writeAll(const char* data, std::size_t count);
+};
+
+
+#endif //LOX_OUTPUT_BUFFER_H
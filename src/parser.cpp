@@ -5,13 +5,24 @@
 #include "parser.h"
 
 #include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <thread>
+#include <utility>
 
-Parser::Parser(std::shared_ptr<std::vector<Token>> tokens, std::shared_ptr<LoxInterpreter> interpreter)
-    : tokens_(std::move(tokens)), interpreter_(std::move(interpreter)) {}
+Parser::Parser(Scanner scanner, AstArena& arena, std::shared_ptr<LoxInterpreter> interpreter)
+    : scanner_(std::move(scanner)), arena_(arena), interpreter_(std::move(interpreter)),
+      lookahead_(LOOKAHEAD_SIZE, Token(TokenType::EOF_TYPE, "", 0)) {}
 
-std::vector<std::shared_ptr<Statement>> Parser::parse() {
-    std::vector<std::shared_ptr<Statement>> statements{};
+std::vector<AstPtr<Statement>> Parser::parse() {
+    if (threads_ > 1 && scanned_ == 0 && scanner_.getText().size() >= PARALLEL_MIN_SOURCE) {
+        if (auto program = parseParallel()) { return std::move(*program); }
+    }
+
+    std::vector<AstPtr<Statement>> statements{};
 
+    // Scanning starts with parsing, scanner errors are reported like parse errors
+    fillLookahead();
     while (!isAtEnd()) {
         statements.push_back(declaration());
     }
@@ -19,7 +30,8 @@ std::vector<std::shared_ptr<Statement>> Parser::parse() {
     return statements;
 }
 
-std::unique_ptr<Expression> Parser::parseExpression() {
+AstPtr<Expression> Parser::parseExpression() {
+    fillLookahead();
     try {
         return expression();
     } catch (const ParseError& e) {
@@ -28,10 +40,139 @@ std::unique_ptr<Expression> Parser::parseExpression() {
 }
 
 void Parser::reset() {
+    scanner_.reset();
+    current_ = 0;
+    scanned_ = 0;
+    hadError_ = false;
+}
+
+void Parser::setThreads(unsigned threads) {
+    threads_ = std::max(threads, 1u);
+}
+
+void Parser::setReportErrors(bool report) {
+    reportErrors_ = report;
+    scanner_.setReportErrors(report);
+}
+
+bool Parser::hadError() const {
+    return hadError_ || scanner_.hadError();
+}
+
+std::optional<std::vector<AstPtr<Statement>>> Parser::parseParallel() {
+    const auto ends = findDeclarationEnds();
+    const std::size_t part_count = std::min(ends.size() / MIN_PART_DECLARATIONS,
+                                            std::size_t{threads_} * PARTS_PER_THREAD);
+    if (part_count < 2) { return std::nullopt; }
+
+    struct Part {
+        std::string_view text;
+        int line = 1;
+        AstArena arena; // Declared first, the nodes are destroyed before it
+        std::vector<AstPtr<Statement>> program;
+        bool failed = false;
+    };
+
+    // Each part ends after a declaration, the last one at the end of the source
+    const auto text = scanner_.getText();
+    std::vector<Part> parts(part_count);
+    DeclarationEnd start{0, 1};
+    for (std::size_t i = 0; i < part_count; ++i) {
+        DeclarationEnd end{text.size(), 0};
+        if (i + 1 < part_count) { end = ends[(i + 1) * ends.size() / part_count - 1]; }
+
+        parts[i].text = text.substr(start.offset, end.offset - start.offset);
+        parts[i].line = start.line;
+        start = end;
+    }
+
+    std::atomic<std::size_t> next_part{0};
+    auto parse_parts = [&] {
+        for (std::size_t i = next_part++; i < parts.size(); i = next_part++) {
+            auto& part = parts[i];
+            try {
+                Parser parser{Scanner{scanner_.getBuffer(), part.text, part.line, interpreter_},
+                              part.arena, interpreter_};
+                parser.setReportErrors(false);
+                part.program = parser.parse();
+                part.failed = parser.hadError();
+            } catch (...) {
+                part.failed = true;
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (std::size_t i = 1; i < std::min<std::size_t>(threads_, parts.size()); ++i) {
+        workers.emplace_back(parse_parts);
+    }
+    parse_parts();
+    for (auto& worker : workers) { worker.join(); }
+
+    if (std::any_of(parts.begin(), parts.end(), [](const Part& part) { return part.failed; })) {
+        return std::nullopt;
+    }
+
+    std::vector<AstPtr<Statement>> statements;
+    for (auto& part : parts) {
+        std::move(part.program.begin(), part.program.end(), std::back_inserter(statements));
+        part.program.clear();
+        arena_.adopt(part.arena);
+    }
+
+    // Leave the parser at the end of the source, like a serial parse
     current_ = 0;
+    scanned_ = 0;
+    scanner_ = Scanner{scanner_.getBuffer(), text.substr(text.size()), start.line, interpreter_};
+    fillLookahead();
+    return statements;
 }
 
-std::shared_ptr<Statement> Parser::declaration() {
+std::vector<Parser::DeclarationEnd> Parser::findDeclarationEnds() const {
+    Scanner scanner{scanner_};
+    scanner.setReportErrors(false);
+    scanner.setInternLiterals(false);
+
+    // A declaration starts with class or fun and a name outside of any braces and parentheses
+    // and ends with the brace closing its body
+    std::vector<DeclarationEnd> ends;
+    int braces = 0;
+    int parens = 0;
+    bool in_declaration = false;
+    TokenType previous_type = TokenType::EOF_TYPE;
+    const char* text = scanner.getText().data();
+
+    for (Token token = scanner.nextToken(); token.getType() != TokenType::EOF_TYPE; token = scanner.nextToken()) {
+        const bool top_level = braces == 0 && parens == 0;
+        switch (token.getType()) {
+            case TokenType::LEFT_PAREN: ++parens; break;
+            case TokenType::RIGHT_PAREN: --parens; break;
+            case TokenType::LEFT_BRACE: ++braces; break;
+            case TokenType::RIGHT_BRACE:
+                if (--braces == 0 && parens == 0 && in_declaration) {
+                    in_declaration = false;
+                    const auto offset = static_cast<std::size_t>(token.getLexeme().data() - text) + 1;
+                    ends.push_back({offset, token.getLine()});
+                }
+                break;
+            case TokenType::CLASS:
+                if (top_level) { in_declaration = true; }
+                break;
+            case TokenType::IDENTIFIER:
+                if (top_level && previous_type == TokenType::FUN) { in_declaration = true; }
+                break;
+            default:
+                break;
+        }
+        previous_type = token.getType();
+    }
+
+    // Without a clean scan the boundaries can not be trusted
+    if (scanner.hadError()) { ends.clear(); }
+    return ends;
+}
+
+AstPtr<Statement> Parser::declaration() {
     try {
         if (match({TokenType::CLASS})) { return classDeclaration(); }
         if (check(TokenType::FUN) && checkNext(TokenType::IDENTIFIER)) {
@@ -46,19 +187,20 @@ std::shared_ptr<Statement> Parser::declaration() {
     }
 }
 
-std::unique_ptr<Statement> Parser::varDeclaration() {
-    const Token& name = consume(TokenType::IDENTIFIER, "Expect variable name.");
+AstPtr<Statement> Parser::varDeclaration() {
+    // Copied, the lookahead slot is reused while parsing the initializer
+    Token name = consume(TokenType::IDENTIFIER, "Expect variable name.");
 
-    std::unique_ptr<Expression> initializer{};
+    AstPtr<Expression> initializer{};
     if (match({TokenType::EQUAL})) {
         initializer = expression();
     }
 
     consume(TokenType::SEMICOLON, "Expect ';' after variable declaration");
-    return std::make_unique<VariableDeclaration>(std::move(initializer), name);
+    return arena_.make<VariableDeclaration>(std::move(initializer), name);
 }
 
-std::unique_ptr<Statement> Parser::statement() {
+AstPtr<Statement> Parser::statement() {
     if (match({TokenType::IF})) {
         return ifStatement();
     }
@@ -79,19 +221,19 @@ std::unique_ptr<Statement> Parser::statement() {
     }
     if (match({TokenType::LEFT_BRACE})) {
         auto statements = block();
-        return std::make_unique<Block>(statements);
+        return arena_.make<Block>(std::move(statements));
     }
 
     return expressionStatement();
 }
 
-std::unique_ptr<Statement> Parser::expressionStatement() {
-    std::unique_ptr<Expression> expr = expression();
+AstPtr<Statement> Parser::expressionStatement() {
+    AstPtr<Expression> expr = expression();
     consume(TokenType::SEMICOLON, "Expect ';' after value.");
-    return std::make_unique<ExpressionStatement>(std::move(expr));
+    return arena_.make<ExpressionStatement>(std::move(expr));
 }
 
-std::shared_ptr<Function> Parser::function(const std::string& kind) {
+AstPtr<Function> Parser::function(const std::string& kind) {
     Token name = consume(TokenType::IDENTIFIER, "Expect " + kind + " name.");
     std::vector<Token> params;
 
@@ -108,38 +250,38 @@ std::shared_ptr<Function> Parser::function(const std::string& kind) {
     consume(TokenType::RIGHT_PAREN, "Expect ')' after parameters");
     consume(TokenType::LEFT_BRACE, "Expect '{' before " + kind + " body.");
 
-    auto body = block();
+    auto body = functionBody();
 
-    return std::make_unique<Function>(name, params, body);
+    return arena_.make<Function>(name, std::move(params), std::move(body));
 }
 
-std::shared_ptr<Statement> Parser::functionDeclaration() {
+AstPtr<Statement> Parser::functionDeclaration() {
     return function("function");
 }
 
-std::shared_ptr<Statement> Parser::classDeclaration() {
+AstPtr<Statement> Parser::classDeclaration() {
     auto name = consume(TokenType::IDENTIFIER, "Expect class name");
 
-    std::unique_ptr<VariableAccess> superclass;
+    AstPtr<VariableAccess> superclass;
     if (match({TokenType::LESS})) {
         consume(TokenType::IDENTIFIER, "Expect superclass name.");
-        superclass = std::make_unique<VariableAccess>(previous());
+        superclass = arena_.make<VariableAccess>(previous());
     }
 
     consume(TokenType::LEFT_BRACE, "Expect '{' before class body");
 
-    std::vector<std::shared_ptr<Function>> methods;
+    std::vector<AstPtr<Function>> methods;
     while (!check(TokenType::RIGHT_BRACE) && !isAtEnd()) {
         methods.push_back(function("method"));
     }
 
     consume(TokenType::RIGHT_BRACE, "Expect '}' after class body.");
 
-    return std::make_shared<ClassDeclaration>(name, std::move(methods), std::move(superclass));
+    return arena_.make<ClassDeclaration>(name, std::move(methods), std::move(superclass));
 }
 
-std::vector<std::shared_ptr<Statement>> Parser::block() {
-    std::vector<std::shared_ptr<Statement>> statements;
+std::vector<AstPtr<Statement>> Parser::block() {
+    std::vector<AstPtr<Statement>> statements;
 
     while (!check(TokenType::RIGHT_BRACE) && !isAtEnd()) {
         statements.push_back(declaration());
@@ -149,39 +291,39 @@ std::vector<std::shared_ptr<Statement>> Parser::block() {
     return statements;
 }
 
-std::unique_ptr<Statement> Parser::printStatement() {
-    std::unique_ptr<Expression> expr = expression();
+AstPtr<Statement> Parser::printStatement() {
+    AstPtr<Expression> expr = expression();
     consume(TokenType::SEMICOLON, "Expect ';' after value.");
-    return std::make_unique<PrintStatement>(std::move(expr));
+    return arena_.make<PrintStatement>(std::move(expr));
 }
 
-std::unique_ptr<Statement> Parser::returnStatement() {
+AstPtr<Statement> Parser::returnStatement() {
     Token keyword = previous();
-    std::unique_ptr<Expression> value{};
+    AstPtr<Expression> value{};
     if (!check(TokenType::SEMICOLON)) {
         value = expression();
     }
 
     consume(TokenType::SEMICOLON, "Expect ';' after return value.");
-    return std::make_unique<Return>(keyword, std::move(value));
+    return arena_.make<Return>(keyword, std::move(value));
 }
 
-std::unique_ptr<Statement> Parser::ifStatement() {
+AstPtr<Statement> Parser::ifStatement() {
     consume(TokenType::LEFT_PAREN, "Expect '(' after if.");
     auto condition = expression();
     consume(TokenType::RIGHT_PAREN, "Expect ')' after if condition");
 
     auto thenBranch = statement();
-    std::unique_ptr<Statement> elseBranch{};
+    AstPtr<Statement> elseBranch{};
     if (match({TokenType::ELSE})) {
         elseBranch = statement();
     }
 
-    return std::make_unique<IfStatement>(std::move(condition), std::move(thenBranch), std::move(elseBranch));
+    return arena_.make<IfStatement>(std::move(condition), std::move(thenBranch), std::move(elseBranch));
 }
 
 
-std::unique_ptr<Statement> Parser::whileStatement() {
+AstPtr<Statement> Parser::whileStatement() {
     consume(TokenType::LEFT_PAREN, "Expect '(' after while.");
     auto condition = expression();
     consume(TokenType::RIGHT_PAREN, "Expect ')' after if condition");
@@ -190,14 +332,14 @@ std::unique_ptr<Statement> Parser::whileStatement() {
     auto thenBranch = statement();
     closeLoop();
 
-    return std::make_unique<WhileStatement>(std::move(condition), std::move(thenBranch));
+    return arena_.make<WhileStatement>(std::move(condition), std::move(thenBranch));
 }
 
-std::unique_ptr<Statement> Parser::forStatement() {
+AstPtr<Statement> Parser::forStatement() {
     consume(TokenType::LEFT_PAREN, "Expect '(' after for.");
 
     // Parse initializer
-    std::unique_ptr<Statement> initializer{};
+    AstPtr<Statement> initializer{};
     if (match({TokenType::SEMICOLON})) {
         initializer = nullptr;
     } else if (match({TokenType::VAR})) {
@@ -207,14 +349,14 @@ std::unique_ptr<Statement> Parser::forStatement() {
     }
 
     // Parse condition
-    std::unique_ptr<Expression> condition{};
+    AstPtr<Expression> condition{};
     if (!check(TokenType::SEMICOLON)) {
         condition = expression();
     }
     consume(TokenType::SEMICOLON, "Expect ';' after loop condition.");
 
     // Parse increment
-    std::unique_ptr<Expression> increment{};
+    AstPtr<Expression> increment{};
     if (!check(TokenType::RIGHT_PAREN)) {
         increment = expression();
     }
@@ -222,22 +364,22 @@ std::unique_ptr<Statement> Parser::forStatement() {
 
     // Parse body
     openLoop();
-    std::unique_ptr<Statement> body = statement();
+    AstPtr<Statement> body = statement();
     closeLoop();
 
     // Desugaring
-    std::vector<std::shared_ptr<Statement>> statements;
+    std::vector<AstPtr<Statement>> statements;
     statements.push_back(std::move(body));
 
     // Add increment if available
     if (increment) {
-        statements.push_back(std::make_unique<ExpressionStatement>(std::move(increment)));
+        statements.push_back(arena_.make<ExpressionStatement>(std::move(increment)));
     }
-    body = std::make_unique<Block>(statements);
+    body = arena_.make<Block>(std::move(statements));
 
     // Add condition
     if (condition) {
-        body = std::make_unique<WhileStatement>(std::move(condition), std::move(body));
+        body = arena_.make<WhileStatement>(std::move(condition), std::move(body));
     }
 
     // Add initializer
@@ -245,55 +387,55 @@ std::unique_ptr<Statement> Parser::forStatement() {
         statements.clear();
         statements.push_back(std::move(initializer));
         statements.push_back(std::move(body));
-        body = std::make_unique<Block>(statements);
+        body = arena_.make<Block>(std::move(statements));
     }
 
     return body;
 }
 
-std::unique_ptr<Statement> Parser::breakStatement() {
+AstPtr<Statement> Parser::breakStatement() {
     if (!isInLoop()) {
         throw error(previous(), "Can only use break within loop");
     }
     consume(TokenType::SEMICOLON, "Expect ';' after break.");
-    return std::make_unique<BreakStatement>();
+    return arena_.make<BreakStatement>();
 }
 
-std::unique_ptr<Expression> Parser::expression(bool disable_comma) {
+AstPtr<Expression> Parser::expression(bool disable_comma) {
     return comma(disable_comma);
 }
 
-std::unique_ptr<Expression> Parser::comma(bool disable_comma) {
+AstPtr<Expression> Parser::comma(bool disable_comma) {
     auto left = assignment();
 
     if (!disable_comma) {
         while (match({TokenType::COMMA})) {
             auto op = previous();
             auto right = assignment();
-            left = std::make_unique<Binary>(std::move(left), op, std::move(right));
+            left = arena_.make<Binary>(std::move(left), op, std::move(right));
         }
     }
 
     return left;
 }
 
-std::unique_ptr<Expression> Parser::assignment() {
+AstPtr<Expression> Parser::assignment() {
     auto left = logicOr();
 
     if (match({TokenType::EQUAL})) {
-        const Token& equals = previous();
+        Token equals = previous();
         auto right = assignment();
 
         if (left->lvalue()) {
             auto* var_access = dynamic_cast<VariableAccess*>(left.get());
             if (var_access) {
                 const Token& name = var_access->getToken();
-                return std::make_unique<Assignment>(name, std::move(right));
+                return arena_.make<Assignment>(name, std::move(right));
             }
 
             auto* get_expr = dynamic_cast<GetExpression*>(left.get());
             if (get_expr) {
-                return std::make_unique<SetExpression>(std::move(get_expr->getObject()), std::move(right),
+                return arena_.make<SetExpression>(std::move(get_expr->getObject()), std::move(right),
                                                        get_expr->getName());
             }
         }
@@ -304,100 +446,100 @@ std::unique_ptr<Expression> Parser::assignment() {
     return left;
 }
 
-std::unique_ptr<Expression> Parser::logicOr() {
+AstPtr<Expression> Parser::logicOr() {
     auto left = logicAnd();
 
     while (match({TokenType::OR})) {
         auto op = previous();
         auto right = logicAnd();
-        left = std::make_unique<Logical>(std::move(left), op, std::move(right));
+        left = arena_.make<Logical>(std::move(left), op, std::move(right));
     }
 
     return left;
 }
 
-std::unique_ptr<Expression> Parser::logicAnd() {
+AstPtr<Expression> Parser::logicAnd() {
     auto left = equality();
 
     while (match({TokenType::AND})) {
         auto op = previous();
         auto right = equality();
-        left = std::make_unique<Logical>(std::move(left), op, std::move(right));
+        left = arena_.make<Logical>(std::move(left), op, std::move(right));
     }
 
     return left;
 }
 
-std::unique_ptr<Expression> Parser::equality() {
+AstPtr<Expression> Parser::equality() {
     auto left = ternary();
     while (match({TokenType::BANG_EQUAL, TokenType::EQUAL_EQUAL})) {
         auto op = previous();
         auto right = ternary();
-        left = std::make_unique<Binary>(std::move(left), op, std::move(right));
+        left = arena_.make<Binary>(std::move(left), op, std::move(right));
     }
 
     return left;
 }
 
-std::unique_ptr<Expression> Parser::ternary() {
+AstPtr<Expression> Parser::ternary() {
     auto left = comparison();
     while (match({TokenType::QUESTION_MARK})) {
         auto middle = expression();
         consume(TokenType::COLON, "Colon expected");
         auto right = comparison();
-        left = std::make_unique<Ternary>(std::move(left), std::move(middle), std::move(right));
+        left = arena_.make<Ternary>(std::move(left), std::move(middle), std::move(right));
     }
 
     return left;
 }
 
-std::unique_ptr<Expression> Parser::comparison() {
+AstPtr<Expression> Parser::comparison() {
     auto left = term();
 
     while (match({TokenType::GREATER, TokenType::GREATER_EQUAL, TokenType::LESS, TokenType::LESS_EQUAL})) {
         auto op = previous();
         auto right = term();
-        left = std::make_unique<Binary>(std::move(left), op, std::move(right));
+        left = arena_.make<Binary>(std::move(left), op, std::move(right));
     }
 
     return left;
 }
 
-std::unique_ptr<Expression> Parser::term() {
+AstPtr<Expression> Parser::term() {
     auto left = factor();
 
     while (match({TokenType::PLUS, TokenType::MINUS})) {
         auto op = previous();
         auto right = factor();
-        left = std::make_unique<Binary>(std::move(left), op, std::move(right));
+        left = arena_.make<Binary>(std::move(left), op, std::move(right));
     }
 
     return left;
 }
 
-std::unique_ptr<Expression> Parser::factor() {
+AstPtr<Expression> Parser::factor() {
     auto left = unary();
 
     while (match({TokenType::STAR, TokenType::SLASH})) {
         auto op = previous();
         auto right = unary();
-        left = std::make_unique<Binary>(std::move(left), op, std::move(right));
+        left = arena_.make<Binary>(std::move(left), op, std::move(right));
     }
 
     return left;
 }
 
-std::unique_ptr<Expression> Parser::unary() {
+AstPtr<Expression> Parser::unary() {
     if (match({TokenType::BANG, TokenType::MINUS})) {
         auto op = previous();
         auto right = primary();
-        return std::make_unique<Unary>(op, std::move(right));
+        return arena_.make<Unary>(op, std::move(right));
     }
 
     return call();
 }
 
-std::unique_ptr<Expression> Parser::call() {
+AstPtr<Expression> Parser::call() {
     auto expr = primary();
 
     while (true) {
@@ -405,7 +547,7 @@ std::unique_ptr<Expression> Parser::call() {
             expr = finishCall(std::move(expr));
         } else if (match({TokenType::DOT})) {
             auto name = consume(TokenType::IDENTIFIER, "Expect property name after '.'.");
-            expr = std::make_unique<GetExpression>(std::move(expr), name);
+            expr = arena_.make<GetExpression>(std::move(expr), name);
         } else {
             break;
         }
@@ -414,11 +556,11 @@ std::unique_ptr<Expression> Parser::call() {
     return expr;
 }
 
-std::unique_ptr<Expression> Parser::primary() {
-    if (match({TokenType::FALSE})) { return std::make_unique<Literal>(false); }
-    if (match({TokenType::TRUE})) { return std::make_unique<Literal>(true); }
-    if (match({TokenType::NIL})) { return std::make_unique<Literal>(); }
-    if (match({TokenType::THIS})) { return std::make_unique<ThisExpression>(previous()); }
+AstPtr<Expression> Parser::primary() {
+    if (match({TokenType::FALSE})) { return arena_.make<Literal>(false); }
+    if (match({TokenType::TRUE})) { return arena_.make<Literal>(true); }
+    if (match({TokenType::NIL})) { return arena_.make<Literal>(); }
+    if (match({TokenType::THIS})) { return arena_.make<ThisExpression>(previous()); }
     if (match({TokenType::FUN})) { return handleFunctionExpression(); }
 
     if (match({TokenType::SUPER})) {
@@ -426,16 +568,15 @@ std::unique_ptr<Expression> Parser::primary() {
         consume(TokenType::DOT, "Expect '.' after 'super'.");
         Token method = consume(TokenType::IDENTIFIER,
                                "Expect superclass method name.");
-        return std::make_unique<SuperExpression>(keyword, method);
+        return arena_.make<SuperExpression>(keyword, method);
     }
 
     if (match({TokenType::NUMBER, TokenType::STRING})) {
-        std::unique_ptr<Literal> literal;
-        auto op = previous();
+        AstPtr<Literal> literal;
 
         std::visit(overload{
-                [&](const double& d) { literal = std::make_unique<Literal>(d); },
-                [&](const std::string& s) { literal = std::make_unique<Literal>(s); },
+                [&](const double& d) { literal = arena_.make<Literal>(d); },
+                [&](LoxString* s) { literal = arena_.make<Literal>(s); },
                 [](const std::monostate&) { throw std::runtime_error("This should never happen"); },
         }, previous().getLiteral());
 
@@ -443,13 +584,13 @@ std::unique_ptr<Expression> Parser::primary() {
     }
 
     if (match({TokenType::IDENTIFIER})) {
-        return std::make_unique<VariableAccess>(previous());
+        return arena_.make<VariableAccess>(previous());
     }
 
     if (match({TokenType::LEFT_PAREN})) {
-        std::unique_ptr<Expression> expr = expression();
+        AstPtr<Expression> expr = expression();
         consume(TokenType::RIGHT_PAREN, "Expect ')' after expression.");
-        return std::make_unique<Grouping>(std::move(expr));
+        return arena_.make<Grouping>(std::move(expr));
     }
 
     throw error(peek(), "Expect expression.");
@@ -476,7 +617,10 @@ bool Parser::checkNext(TokenType type) const {
 }
 
 const Token& Parser::advance() {
-    if (!isAtEnd()) { current_++; }
+    if (!isAtEnd()) {
+        current_++;
+        fillLookahead();
+    }
     return previous();
 }
 
@@ -485,15 +629,22 @@ bool Parser::isAtEnd() const {
 }
 
 const Token& Parser::peek() const {
-    return tokens_->at(current_);
+    return lookahead_[current_ % LOOKAHEAD_SIZE];
 }
 
 const Token& Parser::previous() const {
-    return tokens_->at(current_ - 1);
+    return lookahead_[(current_ - 1) % LOOKAHEAD_SIZE];
 }
 
 const Token& Parser::next() const {
-    return tokens_->at(current_ + 1);
+    return lookahead_[(current_ + 1) % LOOKAHEAD_SIZE];
+}
+
+void Parser::fillLookahead() {
+    while (scanned_ <= current_ + 1) {
+        lookahead_[scanned_ % LOOKAHEAD_SIZE] = scanner_.nextToken();
+        ++scanned_;
+    }
 }
 
 const Token& Parser::consume(TokenType type, std::string_view message) {
@@ -502,7 +653,8 @@ const Token& Parser::consume(TokenType type, std::string_view message) {
 }
 
 ParseError Parser::error(const Token& t, std::string_view message) {
-    interpreter_->error(t, message);
+    hadError_ = true;
+    if (reportErrors_) { interpreter_->error(t, message); }
     return ParseError{};
 }
 
@@ -542,8 +694,16 @@ void Parser::closeLoop() {
     numLoops_--;
 }
 
-std::unique_ptr<Expression> Parser::finishCall(std::unique_ptr<Expression> callee) {
-    std::vector<std::unique_ptr<Expression>> arguments;
+std::vector<AstPtr<Statement>> Parser::functionBody() {
+    // Loops around a function don't enclose its body, break can't leave the function
+    const int enclosing_loops = std::exchange(numLoops_, 0);
+    auto body = block();
+    numLoops_ = enclosing_loops;
+    return body;
+}
+
+AstPtr<Expression> Parser::finishCall(AstPtr<Expression> callee) {
+    std::vector<AstPtr<Expression>> arguments;
     if (!check(TokenType::RIGHT_PAREN)) {
         do {
             if (arguments.size() >= 255) {
@@ -555,10 +715,10 @@ std::unique_ptr<Expression> Parser::finishCall(std::unique_ptr<Expression> calle
 
     Token paren = consume(TokenType::RIGHT_PAREN, "Expect ')' after arguments.");
 
-    return std::make_unique<Call>(std::move(callee), paren, std::move(arguments));
+    return arena_.make<Call>(std::move(callee), paren, std::move(arguments));
 }
 
-std::unique_ptr<Expression> Parser::handleFunctionExpression() {
+AstPtr<Expression> Parser::handleFunctionExpression() {
     std::vector<Token> params;
 
     consume(TokenType::LEFT_PAREN, "Expect '(' after anonymous function declaration.");
@@ -574,9 +734,9 @@ std::unique_ptr<Expression> Parser::handleFunctionExpression() {
     consume(TokenType::RIGHT_PAREN, "Expect ')' after parameters");
     consume(TokenType::LEFT_BRACE, "Expect '{' before function body.");
 
-    auto body = block();
+    auto body = functionBody();
 
-    return std::make_unique<FunctionExpression>(params, body);
+    return arena_.make<FunctionExpression>(std::move(params), std::move(body));
 }
 
 
@@ -6,11 +6,13 @@
 #define LOX_PARSER_H
 
 #include "lox.h"
+#include "scanner.h"
 #include "token.h"
 #include "types.h"
 #include "expressions.h"
 #include "statements.h"
 
+#include <cstddef>
 #include <memory>
 #include <vector>
 #include <string_view>
@@ -23,76 +25,129 @@ class ParseError : public std::exception {
 };
 
 /*!
- * Class that implements a recursive descent parser for the lox language
+ * Class that implements a recursive descent parser for the lox language.
+ * Tokens are pulled from the scanner while parsing, only a small window
+ * of them around the current position is kept. Scanner and parser errors
+ * are thereby reported interleaved, in the order they appear in the source
  */
 class Parser {
 public:
     /*!
      * Construct parser object
-     * @param tokens Token list, from scanner
+     * @param scanner scanner of the source to parse
+     * @param arena arena the nodes of the AST are created in, has to outlive them
      * @param interpreter interpreter context for error reporting
      */
-    explicit Parser(std::shared_ptr<std::vector<Token>> tokens, std::shared_ptr<LoxInterpreter> interpreter);
+    Parser(Scanner scanner, AstArena& arena, std::shared_ptr<LoxInterpreter> interpreter);
 
     /*!
-     * Parse a lox program
+     * Parse a lox program.
+     * Large programs are split after their top-level function and class declarations
+     * and the parts are parsed on several threads. If any part has an error, the
+     * program is parsed again on one thread, so errors are reported as usual
      * @return List of lox statements constituting program
      */
-    std::vector<std::shared_ptr<Statement>> parse();
+    std::vector<AstPtr<Statement>> parse();
 
     /*!
      * Parse an expression
      * @return Expression AST tree root
      */
-    std::unique_ptr<Expression> parseExpression();
+    AstPtr<Expression> parseExpression();
 
     /*!
-     * Reset parser state and errors
+     * Reset parser state and errors, parsing starts over at the beginning of the source
      */
     void reset();
+
+    /*!
+     * Set number of threads parse() may use
+     * @param threads number of threads, 1 parses on the calling thread only
+     */
+    void setThreads(unsigned threads);
+
+    /*!
+     * Select whether errors are reported to the interpreter or only remembered
+     * @param report whether to report errors
+     */
+    void setReportErrors(bool report);
+
+    /*!
+     * Check whether a scanner or parser error was encountered
+     * @return true if there was an error
+     */
+    [[nodiscard]] bool hadError() const;
 private:
-    std::shared_ptr<std::vector<Token>> tokens_;
+    // Sources smaller than this are always parsed on one thread
+    constexpr static std::size_t PARALLEL_MIN_SOURCE = 64 * 1024;
+    // Bounds of the number of top-level declarations per part and parts per thread
+    constexpr static std::size_t MIN_PART_DECLARATIONS = 16;
+    constexpr static std::size_t PARTS_PER_THREAD = 4;
+
+    Scanner scanner_;
+    AstArena& arena_;
     std::shared_ptr<LoxInterpreter> interpreter_;
 
-    // Position in token stream
-    int current_ = 0;
+    // Ring buffer of the tokens from previous() to next(), indexed by stream position
+    constexpr static std::size_t LOOKAHEAD_SIZE = 4;
+    std::vector<Token> lookahead_;
+
+    // Position in token stream and number of tokens pulled from the scanner
+    std::size_t current_ = 0;
+    std::size_t scanned_ = 0;
 
     // Number of loops currently enclosing position
     int numLoops_ = 0;
 
+    unsigned threads_ = 1;
+    bool reportErrors_ = true;
+    bool hadError_ = false;
+
+    /*!
+     * Position in the source right after a top-level declaration
+     */
+    struct DeclarationEnd {
+        std::size_t offset;
+        int line;
+    };
+
+    // Parallel parsing
+    std::optional<std::vector<AstPtr<Statement>>> parseParallel();
+    [[nodiscard]] std::vector<DeclarationEnd> findDeclarationEnds() const;
+
     // Parsing routines for different grammar rules
     // Statements
-    std::shared_ptr<Statement> declaration();
-    std::unique_ptr<Statement> varDeclaration();
-    std::unique_ptr<Statement> statement();
-    std::unique_ptr<Statement> expressionStatement();
-    std::shared_ptr<Statement> functionDeclaration();
-    std::shared_ptr<Statement> classDeclaration();
-    std::vector<std::shared_ptr<Statement>> block();
-    std::unique_ptr<Statement> printStatement();
-    std::unique_ptr<Statement> returnStatement();
-    std::unique_ptr<Statement> ifStatement();
-    std::unique_ptr<Statement> whileStatement();
-    std::unique_ptr<Statement> forStatement();
-    std::unique_ptr<Statement> breakStatement();
+    AstPtr<Statement> declaration();
+    AstPtr<Statement> varDeclaration();
+    AstPtr<Statement> statement();
+    AstPtr<Statement> expressionStatement();
+    AstPtr<Statement> functionDeclaration();
+    AstPtr<Statement> classDeclaration();
+    std::vector<AstPtr<Statement>> block();
+    AstPtr<Statement> printStatement();
+    AstPtr<Statement> returnStatement();
+    AstPtr<Statement> ifStatement();
+    AstPtr<Statement> whileStatement();
+    AstPtr<Statement> forStatement();
+    AstPtr<Statement> breakStatement();
 
     // Expressions
-    std::unique_ptr<Expression> expression(bool disable_comma=false);
-    std::unique_ptr<Expression> assignment();
-    std::unique_ptr<Expression> comma(bool disable_comma);
-    std::unique_ptr<Expression> logicOr();
-    std::unique_ptr<Expression> logicAnd();
-    std::unique_ptr<Expression> equality();
-    std::unique_ptr<Expression> ternary();
-    std::unique_ptr<Expression> comparison();
-    std::unique_ptr<Expression> term();
-    std::unique_ptr<Expression> factor();
-    std::unique_ptr<Expression> unary();
-    std::unique_ptr<Expression> call();
-    std::unique_ptr<Expression> primary();
+    AstPtr<Expression> expression(bool disable_comma=false);
+    AstPtr<Expression> assignment();
+    AstPtr<Expression> comma(bool disable_comma);
+    AstPtr<Expression> logicOr();
+    AstPtr<Expression> logicAnd();
+    AstPtr<Expression> equality();
+    AstPtr<Expression> ternary();
+    AstPtr<Expression> comparison();
+    AstPtr<Expression> term();
+    AstPtr<Expression> factor();
+    AstPtr<Expression> unary();
+    AstPtr<Expression> call();
+    AstPtr<Expression> primary();
 
     // Helper to handle both functions and methods
-    std::shared_ptr<Function> function(const std::string& kind);
+    AstPtr<Function> function(const std::string& kind);
 
     // Matching and handling of tokens
     bool match(std::initializer_list<TokenType> types);
@@ -103,15 +158,17 @@ private:
     [[nodiscard]] const Token& peek() const;
     [[nodiscard]] const Token& previous() const;
     [[nodiscard]] const Token& next() const;
+    void fillLookahead();
     [[nodiscard]] bool isInLoop() const;
     void openLoop();
     void closeLoop();
+    std::vector<AstPtr<Statement>> functionBody();
 
     // Handling of function calls
-    std::unique_ptr<Expression> finishCall(std::unique_ptr<Expression> callee);
+    AstPtr<Expression> finishCall(AstPtr<Expression> callee);
 
     // Handling of function expressions
-    std::unique_ptr<Expression> handleFunctionExpression();
+    AstPtr<Expression> handleFunctionExpression();
 
     // Error reporting and recovery
     const Token& consume(TokenType type, std::string_view message);
@@ -6,15 +6,22 @@
 #include "resolver.h"
 #include "lox.h"
 #include "native_functions/clock.h"
+#include "native_functions/flush.h"
+
+#include <algorithm>
 
 Resolver::Resolver(std::shared_ptr<Interpreter> interpreter,
                    std::shared_ptr<LoxInterpreter> context,
                    bool test_mode)
-    : interpreter_{std::move(interpreter)}, context_{std::move(context)}, scopes_{}, usage_{}
+    : interpreter_{std::move(interpreter)}, context_{std::move(context)}, scopes_{}, usage_{}, functions_(1)
 {
     Token clockToken = Token(TokenType::IDENTIFIER, "clock", 0);
-    defineGlobal(clockToken);
-    interpreter_->defineGlobal(std::make_shared<Clock>(test_mode));
+    defineGlobal(clockToken, nullptr);
+    interpreter_->defineGlobal(interpreter_->getHeap().allocate<Clock>(test_mode));
+
+    Token flushToken = Token(TokenType::IDENTIFIER, "flush", 0);
+    defineGlobal(flushToken, nullptr);
+    interpreter_->defineGlobal(interpreter_->getHeap().allocate<Flush>());
 }
 
 void Resolver::visitBinary(Binary& b) {
@@ -50,7 +57,7 @@ void Resolver::visitVariableAccess(VariableAccess& v) {
         }
     }
 
-    resolveLocal(&v, v.getToken());
+    resolveLocal(v.getToken(), v.getLocation());
 
     if (!usage_.empty()) {
         for (int i = static_cast<int>(usage_.size()) - 1; i >= 0; --i) {
@@ -64,7 +71,7 @@ void Resolver::visitVariableAccess(VariableAccess& v) {
 
 void Resolver::visitAssignment(Assignment& a) {
     resolve(*a.getValue());
-    resolveLocal(&a, a.getName());
+    resolveLocal(a.getName(), a.getLocation());
 }
 
 void Resolver::visitLogical(Logical& l) {
@@ -89,17 +96,7 @@ void Resolver::visitSetExpression(SetExpression& s) {
 }
 
 void Resolver::visitFunctionExpression(FunctionExpression& f) {
-    auto enclosing = currentFunction_;
-    currentFunction_ = FunctionType::FUNCTION;
-
-    beginScope();
-    for (const auto& param : f.getParams()) {
-        declare(param);
-        define(param);
-    }
-    resolve(f.getBody());
-    endScope();
-    currentFunction_ = enclosing;
+    resolveFunction(f.getPrototype(), FunctionType::FUNCTION);
 }
 
 void Resolver::visitThisExpression(ThisExpression& t) {
@@ -108,7 +105,7 @@ void Resolver::visitThisExpression(ThisExpression& t) {
                         "Can't use 'this' outside of a class.");
         return;
     }
-    resolveLocal(&t, t.getKeyword());
+    resolveLocal(t.getKeyword(), t.getLocation());
 }
 
 void Resolver::visitSuperExpression(SuperExpression& s) {
@@ -119,7 +116,10 @@ void Resolver::visitSuperExpression(SuperExpression& s) {
         context_->error(s.getKeyword(),
                         "Can't use 'super' in a class with no superclass.");
     }
-    resolveLocal(&s, s.getKeyword());
+    resolveLocal(s.getKeyword(), s.getLocation());
+    if (currentClass_ != ClassType::NONE) {
+        resolveLocal(Token(TokenType::THIS, "this", s.getKeyword().getLine()), s.getThisLocation());
+    }
 }
 
 void Resolver::visitExpressionStatement(ExpressionStatement& s) {
@@ -131,14 +131,23 @@ void Resolver::visitPrintStatement(PrintStatement& p) {
 }
 
 void Resolver::visitVariableDeclaration(VariableDeclaration& v) {
-    declare(v.getToken());
+    declare(v.getToken(), &v.getLocation());
     if (v.getExpression()) {
         resolve(*v.getExpression());
     }
-    define(v.getToken());
+    define(v.getToken(), &v.getLocation());
 }
 
 void Resolver::visitBlock(Block& b) {
+    // Blocks without declarations of their own, like most loop bodies, share the enclosing scope
+    const auto& statements = b.getStatements();
+    bool declares = std::any_of(statements.begin(), statements.end(),
+                                [](const auto& statement) { return statement->isDeclaration(); });
+    if (!declares) {
+        resolve(b.getStatements());
+        return;
+    }
+
     beginScope();
     resolve(b.getStatements());
     endScope();
@@ -162,23 +171,40 @@ void Resolver::visitBreakStatement(BreakStatement& b) {
 }
 
 void Resolver::visitFunction(Function& f) {
-    declare(f.getName());
-    define(f.getName());
+    declare(f.getName(), &f.getLocation());
+    define(f.getName(), &f.getLocation());
 
-    resolveFunction(f, FunctionType::FUNCTION);
+    resolveFunction(f.getPrototype(), FunctionType::FUNCTION);
 }
 
-void Resolver::resolveFunction(Function& f, FunctionType type) {
+void Resolver::resolveFunction(FunctionPrototype& prototype, FunctionType type) {
     auto enclosing = currentFunction_;
     currentFunction_ = type;
 
+    functions_.emplace_back();
     beginScope();
-    for (const auto& param : f.getParams()) {
-        declare(param);
-        define(param);
+    if (type == FunctionType::METHOD || type == FunctionType::INITIALIZER) {
+        // Methods receive "this" in the first register of their call
+        declareParameter(Token(TokenType::THIS, "this", -1));
+    }
+    for (const auto& param : prototype.params) {
+        declareParameter(param);
+    }
+    resolve(prototype.body);
+
+    // Parameters are not declared by a statement, the call promotes the captured ones
+    prototype.capturedParameters.clear();
+    for (const auto& pair : locals_.back()) {
+        if (pair.second.parameter && pair.second.captured) {
+            prototype.capturedParameters.push_back(pair.second.slot);
+        }
     }
-    resolve(f.getBody());
+    std::sort(prototype.capturedParameters.begin(), prototype.capturedParameters.end());
     endScope();
+
+    prototype.slotCount = functions_.back().slotCount;
+    prototype.upvalues = std::move(functions_.back().upvalues);
+    functions_.pop_back();
     currentFunction_ = enclosing;
 }
 
@@ -196,7 +222,7 @@ void Resolver::visitClassDeclaration(ClassDeclaration& c) {
     ClassType curType = currentClass_;
     currentClass_ = ClassType::CLASS;
 
-    declare(c.getName());
+    declare(c.getName(), &c.getLocation());
 
     if (c.getSuperclass() && c.getName().getLexeme() == c.getSuperclass()->getToken().getLexeme()) {
         context_->error(c.getSuperclass()->getToken(), "A class can't inherit from itself.");
@@ -210,36 +236,32 @@ void Resolver::visitClassDeclaration(ClassDeclaration& c) {
     if (c.getSuperclass()) {
         beginScope();
         Token super_token(TokenType::THIS, "super", -1);
-        scopes_.back()[super_token] = true;
+        declare(super_token, &c.getSuperLocation());
+        define(super_token, &c.getSuperLocation());
     }
 
-    beginScope();
-    Token this_token(TokenType::THIS, "this", -1);
-    scopes_.back()[this_token] = true;
-
     for (const auto& method : c.getMethods()) {
         auto declaration = FunctionType::METHOD;
         if (method->getName().getLexeme() == "init") {
             declaration = FunctionType::INITIALIZER;
         }
-        resolveFunction(*method, declaration);
+        resolveFunction(method->getPrototype(), declaration);
     }
 
-    endScope();
-
     if (c.getSuperclass()) {
         endScope();
     }
 
-    define(c.getName());
+    define(c.getName(), &c.getLocation());
     currentClass_ = curType;
 }
 
 void Resolver::beginScope() {
     scopes_.emplace_back();
     usage_.emplace_back();
-    localLocations_.emplace_back();
-    localIndexStack_.emplace_back(0);
+    locals_.emplace_back();
+    scopeFunctions_.push_back(functions_.size() - 1);
+    scopeSlots_.push_back(functions_.back().nextSlot);
 }
 
 void Resolver::endScope() {
@@ -250,10 +272,21 @@ void Resolver::endScope() {
             context_->error(name, "Local variable not used.");
         }
     }
+
+    // Only now all accesses are known, captured locals are promoted to cells at every site
+    for (const auto& pair : locals_.back()) {
+        if (!pair.second.captured) { continue; }
+        for (auto* site : pair.second.sites) {
+            site->captured = true;
+        }
+    }
+
+    functions_[scopeFunctions_.back()].nextSlot = scopeSlots_.back();
     scopes_.pop_back();
     usage_.pop_back();
-    localLocations_.pop_back();
-    localIndexStack_.pop_back();
+    locals_.pop_back();
+    scopeFunctions_.pop_back();
+    scopeSlots_.pop_back();
 }
 
 void Resolver::resolve(Expression& e) {
@@ -264,13 +297,17 @@ void Resolver::resolve(Statement& s) {
     s.accept(*this);
 }
 
-void Resolver::resolve(std::vector<std::shared_ptr<Statement>>& statements) {
+void Resolver::resolve(std::vector<AstPtr<Statement>>& statements) {
     for (auto& statement_ptr : statements) {
         resolve(*statement_ptr);
     }
 }
 
-void Resolver::declare(const Token& name) {
+std::size_t Resolver::getScriptSlotCount() const {
+    return functions_.front().slotCount;
+}
+
+void Resolver::declare(const Token& name, VariableLocation* site) {
     if (scopes_.empty()) { return; }
     auto& scope = scopes_.back();
     if (scope.count(name)) {
@@ -278,44 +315,86 @@ void Resolver::declare(const Token& name) {
                         "Already a variable with this name in this scope.");
     }
     scope[name] = false;
+    declareLocal(name, site);
 }
 
-void Resolver::define(const Token& name) {
+void Resolver::define(const Token& name, VariableLocation* site) {
     if (scopes_.empty()) {
-        defineGlobal(name);
+        defineGlobal(name, site);
         return;
     }
     auto& scope = scopes_.back();
     scope[name] = true;
-    defineLocal(name);
 }
 
-void Resolver::resolveLocal(Expression* expr, const Token& name) {
+void Resolver::declareParameter(const Token& name) {
+    declare(name, nullptr);
+    define(name, nullptr);
+    locals_.back()[name].parameter = true;
+}
+
+void Resolver::resolveLocal(const Token& name, VariableLocation& site) {
     for (int i = static_cast<int>(scopes_.size()) - 1; i >= 0; --i) {
-        if (scopes_[i].count(name)) {
-            interpreter_->resolve(expr, localLocations_[i][name], scopes_.size() - i - 1);
-            return;
+        auto it = locals_[i].find(name);
+        if (it == locals_[i].end()) { continue; }
+
+        Local& local = it->second;
+        const auto owner = scopeFunctions_[i];
+        if (owner == functions_.size() - 1) {
+            site = VariableLocation{VariableLocation::Kind::LOCAL, false, local.slot};
+            local.sites.push_back(&site);
+        } else {
+            local.captured = true;
+            site = VariableLocation{VariableLocation::Kind::UPVALUE, false,
+                                    addUpvalue(functions_.size() - 1, owner, local.slot)};
+            if (site.index > MAX_SLOT) {
+                context_->error(name, "Too many closure variables in function.");
+            }
         }
+        return;
     }
 
     if (!globalLocations_.count(name)) {
         context_->error(name, "Undefined variable.");
     }
-    interpreter_->resolve(expr, globalLocations_[name], GLOBAL_DEPTH);
+    site = VariableLocation{VariableLocation::Kind::GLOBAL, false, globalLocations_[name]};
 }
 
-void Resolver::defineGlobal(const Token& name) {
-    auto location = globalIndex_++;
-    globalLocations_[name] = location;
-}
+std::size_t Resolver::addUpvalue(std::size_t function, std::size_t owner, std::size_t slot) {
+    // Functions between the owner and the accessing one pass the variable down as an upvalue
+    UpvalueDescriptor descriptor{true, slot};
+    if (function - 1 != owner) {
+        descriptor = UpvalueDescriptor{false, addUpvalue(function - 1, owner, slot)};
+    }
 
-void Resolver::defineLocal(const Token& name) {
-    auto& current_map = localLocations_.back();
-    auto& index = localIndexStack_.back();
-    auto location = index++;
-    current_map[name] = location;
+    auto& upvalues = functions_[function].upvalues;
+    for (std::size_t i = 0; i < upvalues.size(); ++i) {
+        if (upvalues[i].local == descriptor.local && upvalues[i].index == descriptor.index) { return i; }
+    }
+    upvalues.push_back(descriptor);
+    return upvalues.size() - 1;
 }
 
+void Resolver::defineGlobal(const Token& name, VariableLocation* site) {
+    auto location = globalIndex_++;
+    globalLocations_[name] = location;
+    if (site) {
+        *site = VariableLocation{VariableLocation::Kind::GLOBAL, false, location};
+    }
+}
 
+void Resolver::declareLocal(const Token& name, VariableLocation* site) {
+    auto& function = functions_.back();
+    Local local;
+    local.slot = function.nextSlot++;
+    function.slotCount = std::max(function.slotCount, function.nextSlot);
+    if (local.slot == MAX_SLOT + 1) {
+        context_->error(name, "Too many local variables in function.");
+    }
 
-
+    if (site) {
+        *site = VariableLocation{VariableLocation::Kind::LOCAL, false, local.slot};
+        local.sites.push_back(site);
+    }
+    locals_.back()[name] = std::move(local);
+}
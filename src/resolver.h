@@ -8,6 +8,7 @@
 #include "statements.h"
 #include "interpreter.h"
 
+#include <cstdint>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -36,6 +37,9 @@ enum class ClassType {
  */
 class Resolver : public ExpressionVisitor, public StatementVisitor {
 public:
+    // Largest register and upvalue index of a function, bytecode operands have 16 bits
+    constexpr static std::size_t MAX_SLOT = UINT16_MAX;
+
     /**
      * Constructor
      * @param interpreter reference to interpreter
@@ -51,7 +55,14 @@ public:
      * Resolve program, used by runtime to execute resolve pass
      * @param statements program
      */
-    void resolve(std::vector<std::shared_ptr<Statement>>& statements);
+    void resolve(std::vector<AstPtr<Statement>>& statements);
+
+    /**
+     * Get number of registers needed by locals of the top-level code,
+     * i.e. variables declared in blocks outside of functions
+     * @return register count
+     */
+    [[nodiscard]] std::size_t getScriptSlotCount() const;
 
     void visitBinary(Binary &b) override;
     void visitTernary(Ternary &t) override;
@@ -81,11 +92,26 @@ public:
 
     ~Resolver() override = default;
 
+private:
     /**
-     * Marker value for expressions in global scope
+     * Local variable of a scope
      */
-    constexpr static std::size_t GLOBAL_DEPTH = std::numeric_limits<std::size_t>::max();
-private:
+    struct Local {
+        std::size_t slot = 0;
+        bool parameter = false; // This or a parameter, promoted to a cell on function entry if captured
+        bool captured = false;
+        std::vector<VariableLocation*> sites; // Declaration and accesses from the declaring function
+    };
+
+    /**
+     * Registers and upvalues of a function being resolved
+     */
+    struct FunctionScope {
+        std::size_t nextSlot = 0;
+        std::size_t slotCount = 0;
+        std::vector<UpvalueDescriptor> upvalues;
+    };
+
     std::shared_ptr<Interpreter> interpreter_;
     std::shared_ptr<LoxInterpreter> context_;
     std::vector<std::unordered_map<Token, bool>> scopes_;
@@ -93,25 +119,31 @@ private:
     FunctionType currentFunction_ = FunctionType::NONE;
     ClassType currentClass_ = ClassType::NONE;
 
-    std::vector<std::unordered_map<Token, std::size_t>> localLocations_;
+    std::vector<std::unordered_map<Token, Local>> locals_;
     std::unordered_map<Token, std::size_t> globalLocations_;
-
-    std::vector<std::size_t> localIndexStack_;
     std::size_t globalIndex_ = 0;
 
+    // The first function is the top-level code, each scope belongs to one function
+    std::vector<FunctionScope> functions_;
+    std::vector<std::size_t> scopeFunctions_;
+    // First register of each scope, registers are reused once the scope ends
+    std::vector<std::size_t> scopeSlots_;
+
     void beginScope();
     void endScope();
 
     void resolve(Expression& e);
     void resolve(Statement& s);
 
-    void declare(const Token& name);
-    void define(const Token& name);
-    void resolveLocal(Expression* expr, const Token& name);
+    void declare(const Token& name, VariableLocation* site);
+    void define(const Token& name, VariableLocation* site);
+    void declareParameter(const Token& name);
+    void resolveLocal(const Token& name, VariableLocation& site);
+    std::size_t addUpvalue(std::size_t function, std::size_t owner, std::size_t slot);
 
-    void resolveFunction(Function& f, FunctionType type);
-    void defineGlobal(const Token& name);
-    void defineLocal(const Token& name);
+    void resolveFunction(FunctionPrototype& prototype, FunctionType type);
+    void defineGlobal(const Token& name, VariableLocation* site);
+    void declareLocal(const Token& name, VariableLocation* site);
 };
 
 
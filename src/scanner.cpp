@@ -3,8 +3,20 @@
 //
 
 #include "scanner.h"
+#include "heap.h"
 
-const std::map<std::string, TokenType> Scanner::keywords_ = {
+#include <array>
+#include <charconv>
+#include <stdexcept>
+
+namespace {
+
+struct Keyword {
+    std::string_view text;
+    TokenType type;
+};
+
+constexpr std::array<Keyword, 17> KEYWORDS = {{
         {"and", TokenType::AND},
         {"class", TokenType::CLASS},
         {"else", TokenType::ELSE},
@@ -22,36 +34,122 @@ const std::map<std::string, TokenType> Scanner::keywords_ = {
         {"var", TokenType::VAR},
         {"while", TokenType::WHILE},
         {"break", TokenType::BREAK}
-};
+}};
+
+constexpr std::size_t KEYWORD_TABLE_SIZE = 32;
+
+/**
+ * Hash over the length and the first and last character, collision free on the keywords
+ * @param text identifier, not empty
+ * @return slot in the keyword table
+ */
+constexpr std::size_t keywordHash(std::string_view text) {
+    return (text.length() + static_cast<unsigned char>(text.front()) +
+            7 * static_cast<unsigned char>(text.back())) % KEYWORD_TABLE_SIZE;
+}
+
+/**
+ * Build perfect hash table of the keywords, free slots have an empty text
+ * @return keyword table, indexed by keywordHash
+ */
+constexpr std::array<Keyword, KEYWORD_TABLE_SIZE> makeKeywordTable() {
+    std::array<Keyword, KEYWORD_TABLE_SIZE> table{};
+    for (auto& entry : table) { entry = {"", TokenType::IDENTIFIER}; }
+
+    for (const auto& keyword : KEYWORDS) {
+        auto& entry = table[keywordHash(keyword.text)];
+        // Not a constant expression, so a collision fails the build
+        if (!entry.text.empty()) { throw std::logic_error("Keyword hash collision"); }
+        entry = keyword;
+    }
+    return table;
+}
 
-Scanner::Scanner(std::unique_ptr<std::string> source, std::shared_ptr<LoxInterpreter> loxInterpreter)
-    : source_{std::move(source)}, interpreter_{std::move(loxInterpreter)},
-      tokens_(std::make_shared<std::vector<Token>>()) {}
+constexpr auto KEYWORD_TABLE = makeKeywordTable();
 
-std::shared_ptr<std::vector<Token>> Scanner::getTokens() const {
-    return tokens_;
+/**
+ * Classify identifier without allocating, a hash followed by one comparison
+ * @param text identifier, not empty
+ * @return keyword token type, IDENTIFIER for other names
+ */
+constexpr TokenType identifierType(std::string_view text) {
+    const auto& keyword = KEYWORD_TABLE[keywordHash(text)];
+    return keyword.text == text ? keyword.type : TokenType::IDENTIFIER;
 }
 
-void Scanner::scanTokens() {
-    while(!isAtEnd()) {
+static_assert(identifierType("while") == TokenType::WHILE);
+static_assert(identifierType("whale") == TokenType::IDENTIFIER);
+
+}
+
+
+Scanner::Scanner(std::shared_ptr<const SourceBuffer> source, std::shared_ptr<LoxInterpreter> loxInterpreter)
+    : interpreter_{std::move(loxInterpreter)}, buffer_{std::move(source)}, source_{buffer_->getText()} {}
+
+Scanner::Scanner(std::shared_ptr<const SourceBuffer> source, std::string_view part, int line,
+                 std::shared_ptr<LoxInterpreter> loxInterpreter)
+    : interpreter_{std::move(loxInterpreter)}, buffer_{std::move(source)}, source_{part},
+      line_{line}, firstLine_{line} {}
+
+Token Scanner::nextToken() {
+    while (true) {
+        current_ = skipWhitespace(source_, current_, line_);
         start_ = current_;
+        if (isAtEnd()) { return {TokenType::EOF_TYPE, source_.substr(start_), line_}; }
+
         scanToken();
+        if (token_) {
+            Token token = *token_;
+            token_.reset();
+            return token;
+        }
     }
+}
+
+void Scanner::reset() {
+    start_ = 0;
+    current_ = 0;
+    line_ = firstLine_;
+    hadError_ = false;
+    token_.reset();
+}
+
+void Scanner::setReportErrors(bool report) {
+    reportErrors_ = report;
+}
+
+void Scanner::setInternLiterals(bool intern) {
+    internLiterals_ = intern;
+}
+
+bool Scanner::hadError() const {
+    return hadError_;
+}
+
+const std::shared_ptr<const SourceBuffer>& Scanner::getBuffer() const {
+    return buffer_;
+}
 
-    addToken(TokenType::EOF_TYPE);
+std::string_view Scanner::getText() const {
+    return source_;
+}
+
+void Scanner::error(std::string_view message) {
+    hadError_ = true;
+    if (reportErrors_) { interpreter_->error(line_, message); }
 }
 
 bool Scanner::isAtEnd() const {
-    return current_ >= source_->length();
+    return current_ >= source_.length();
 }
 
 char Scanner::advance() {
-    return source_->at(current_++);
+    return source_[current_++];
 }
 
 bool Scanner::match(char expected) {
     if (isAtEnd()) { return false; }
-    if (source_->at(current_) != expected) { return false; }
+    if (source_[current_] != expected) { return false; }
 
     ++current_;
     return true;
@@ -59,22 +157,19 @@ bool Scanner::match(char expected) {
 
 char Scanner::peek() {
     if (isAtEnd()) return '\0';
-    return source_->at(current_);
+    return source_[current_];
 }
 
 char Scanner::peekNext() {
-    if (current_ + 1 >= source_->length()) return '\0';
-    return source_->at(current_ + 1);
+    if (current_ + 1 >= source_.length()) return '\0';
+    return source_[current_ + 1];
 }
 
 void Scanner::string() {
-    while (peek() != '"' && !isAtEnd()) {
-        if (peek() == '\n') line_++;
-        advance();
-    }
+    current_ = findQuote(source_, current_, line_);
 
     if (isAtEnd()) {
-        interpreter_->error(line_, "Unterminated string.");
+        error("Unterminated string.");
         return;
     }
 
@@ -82,7 +177,7 @@ void Scanner::string() {
     advance();
 
     // Trim the surrounding quotes
-    auto value = source_->substr(start_ + 1, current_ - start_ - 2);
+    auto value = source_.substr(start_ + 1, current_ - start_ - 2);
     addToken(value);
 }
 
@@ -96,19 +191,15 @@ void Scanner::number() {
         while (isDigit(peek())) { advance(); }
     }
 
-    auto value = std::stod(source_->substr(start_, current_ - start_));
+    double value = 0.0;
+    std::from_chars(source_.data() + start_, source_.data() + current_, value);
     addToken(value);
 }
 
 void Scanner::identifier() {
-    while (isAlphaNumeric(peek())) advance();
+    current_ = skipIdentifier(source_, current_);
 
-    auto text = source_->substr(start_, current_ - start_);
-    if (keywords_.contains(text)) {
-        addToken(keywords_.at(text));
-    } else {
-        addToken(TokenType::IDENTIFIER);
-    }
+    addToken(identifierType(source_.substr(start_, current_ - start_)));
 }
 
 bool Scanner::isAlpha(char c) {
@@ -121,23 +212,34 @@ bool Scanner::isDigit(char c) {
     return c >= '0' && c <= '9';
 }
 
-bool Scanner::isAlphaNumeric(char c) {
-    return isAlpha(c) || isDigit(c);
+std::string_view Scanner::currentLexeme() {
+    auto lexeme = source_.substr(start_, current_ - start_);
+    if (lexeme.length() > Token::MAX_LEXEME_LENGTH) {
+        error("Token too long.");
+        return lexeme.substr(0, Token::MAX_LEXEME_LENGTH);
+    }
+    return lexeme;
 }
 
 void Scanner::addToken(TokenType type) {
-    auto lexeme = source_->substr(start_, current_ - start_);
-    tokens_->emplace_back(type, lexeme, line_);
+    auto lexeme = currentLexeme();
+    token_.emplace(type, lexeme, line_);
 }
 
 void Scanner::addToken(std::string_view literal) {
-    auto lexeme = source_->substr(start_, current_ - start_);
-    tokens_->emplace_back(TokenType::STRING, lexeme, line_, literal);
+    auto lexeme = currentLexeme();
+    if (!internLiterals_) {
+        token_.emplace(TokenType::STRING, lexeme, line_);
+        return;
+    }
+
+    // String literals are interned once while scanning and live as long as the interpreter
+    token_.emplace(TokenType::STRING, lexeme, line_, interpreter_->getHeap().internLiteral(literal));
 }
 
 void Scanner::addToken(double literal) {
-    auto lexeme = source_->substr(start_, current_ - start_);
-    tokens_->emplace_back(TokenType::NUMBER, lexeme, line_, literal);
+    auto lexeme = currentLexeme();
+    token_.emplace(TokenType::NUMBER, lexeme, line_, literal);
 }
 
 void Scanner::scanToken() {
@@ -172,11 +274,12 @@ void Scanner::scanToken() {
         case '/':
             if (match('/')) {
                 // A comment goes until the end of the line.
-                while (peek() != '\n' && !isAtEnd()) advance();
+                current_ = findNewline(source_, current_);
             } else if (match('*')) { // Multi-line comments
                 int num_comments_opened = 1;
                 bool comment_done = false;
                 while (!comment_done && !isAtEnd()) {
+                    current_ = findCommentDelimiter(source_, current_);
                     if (match('*') && match('/')) {
                         num_comments_opened -= 1;
                     } else if (match('/') && match('*')) {
@@ -189,7 +292,7 @@ void Scanner::scanToken() {
                 }
 
                 if (isAtEnd() && num_comments_opened > 0) {
-                    interpreter_->error(line_, "Multi-line comment not closed");
+                    error("Multi-line comment not closed");
                 }
             } else {
                 addToken(TokenType::SLASH);
@@ -212,7 +315,7 @@ void Scanner::scanToken() {
                 number();
             } else if (isAlpha(c)) {
                 identifier();
-            } else { interpreter_->error(line_, "Unexpected character encountered"); }
+            } else { error("Unexpected character encountered"); }
             break;
     }
 }
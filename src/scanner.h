@@ -7,46 +7,96 @@
 
 #include "token.h"
 #include "lox.h"
+#include "source_buffer.h"
+#include "char_scan.h"
 
 #include <string_view>
 #include <string>
-#include <vector>
+#include <optional>
 #include <memory>
-#include <map>
 
 /*!
- * Lexer, produces tokens from raw input
+ * Lexer, produces tokens from raw input.
+ * Tokens are pulled one at a time, so the scanner keeps no token list
+ * and scanning runs interleaved with parsing
  */
 class Scanner {
 public:
     /*!
      * Constructor
-     * @param source source string, class takes ownership
+     * @param source source text, read in place
      * @param loxInterpreter reference to interpreter context for error reporting
      */
-    Scanner(std::unique_ptr<std::string> source, std::shared_ptr<LoxInterpreter> loxInterpreter);
+    Scanner(std::shared_ptr<const SourceBuffer> source, std::shared_ptr<LoxInterpreter> loxInterpreter);
 
     /*!
-     * Return any tokens after scanning
-     * @return tokens
+     * Constructor for scanning part of a source
+     * @param source source text, read in place
+     * @param part range of the source text to scan
+     * @param line line number the range starts in
+     * @param loxInterpreter reference to interpreter context for error reporting
+     */
+    Scanner(std::shared_ptr<const SourceBuffer> source, std::string_view part, int line,
+            std::shared_ptr<LoxInterpreter> loxInterpreter);
+
+    /*!
+     * Scan next token in source
+     * @return next token, a token of type EOF_TYPE at the end of the source and on every call after
+     */
+    Token nextToken();
+
+    /*!
+     * Restart scanning at the beginning of the source
+     */
+    void reset();
+
+    /*!
+     * Select whether errors are reported to the interpreter or only remembered
+     * @param report whether to report errors
+     */
+    void setReportErrors(bool report);
+
+    /*!
+     * Select whether string tokens carry their interned value.
+     * Without, their value is null and scanning does not touch the heap, e.g. when only looking for token types
+     * @param intern whether to intern string literals
+     */
+    void setInternLiterals(bool intern);
+
+    /*!
+     * Check whether an error was encountered since construction or the last reset
+     * @return true if there was an error
      */
-    [[nodiscard]] std::shared_ptr<std::vector<Token>> getTokens() const;
+    [[nodiscard]] bool hadError() const;
 
     /*!
-     * Scan tokens in source
+     * Get source buffer the scanned text is part of
+     * @return source buffer
      */
-    void scanTokens();
+    [[nodiscard]] const std::shared_ptr<const SourceBuffer>& getBuffer() const;
+
+    /*!
+     * Get scanned text
+     * @return text, the whole source or the part given to the constructor
+     */
+    [[nodiscard]] std::string_view getText() const;
 private:
-    const static std::map<std::string, TokenType> keywords_;
     std::shared_ptr<LoxInterpreter> interpreter_;
-    std::unique_ptr<std::string> source_;
+    std::shared_ptr<const SourceBuffer> buffer_;
+    std::string_view source_;
 
-    std::shared_ptr<std::vector<Token>> tokens_;
+    // Set by addToken, scanning a lexeme like a comment may not produce a token
+    std::optional<Token> token_;
 
     // Information about where we are in the code
-    int start_ = 0;
-    int current_ = 0;
+    std::size_t start_ = 0;
+    std::size_t current_ = 0;
     int line_ = 1;
+    int firstLine_ = 1;
+
+    bool reportErrors_ = true;
+    bool internLiterals_ = true;
+    bool hadError_ = false;
 
     // Information about position in source and extraction of chars from the source
     [[nodiscard]] bool isAtEnd() const;
@@ -55,6 +105,12 @@ private:
     char peekNext();
     bool match(char expected);
 
+    // Report error in the current line
+    void error(std::string_view message);
+
+    // Lexeme of the token being scanned, a view into the source
+    std::string_view currentLexeme();
+
     // Adding various types of tokens
     void addToken(TokenType type);
     void addToken(std::string_view literal);
@@ -68,7 +124,6 @@ private:
     // Needed for literals and identifiers
     static bool isAlpha(char c);
     static bool isDigit(char c);
-    static bool isAlphaNumeric(char c);
 
     // Main function for scanning tokens
     void scanToken();
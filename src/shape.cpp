@@ -0,0 +1,43 @@
+#include "shape.h"
+
+Shape::Shape() : id_{nextId_++} {}
+
+Shape::Shape(const Shape& parent, std::string_view name) : id_{nextId_++}, fields_{parent.fields_} {
+    fields_.emplace_back(name);
+
+    if (fields_.size() > INDEX_THRESHOLD) {
+        // Views point into fields_, which is not modified after construction
+        for (std::size_t i = 0; i < fields_.size(); ++i) {
+            index_.emplace(fields_[i], i);
+        }
+    }
+}
+
+std::optional<std::size_t> Shape::lookup(std::string_view name) const {
+    if (!index_.empty()) {
+        auto it = index_.find(name);
+        if (it != index_.end()) { return it->second; }
+        return std::nullopt;
+    }
+
+    for (std::size_t i = 0; i < fields_.size(); ++i) {
+        if (fields_[i] == name) { return i; }
+    }
+    return std::nullopt;
+}
+
+Shape* Shape::addField(std::string_view name) {
+    if (auto it = transitions_.find(name); it != transitions_.end()) { return it->second.get(); }
+
+    auto& child = transitions_[std::string{name}];
+    child.reset(new Shape(*this, name));
+    return child.get();
+}
+
+std::size_t Shape::getFieldCount() const {
+    return fields_.size();
+}
+
+std::uint64_t Shape::getId() const {
+    return id_;
+}
@@ -0,0 +1,80 @@
+#ifndef LOX_SHAPE_H
+#define LOX_SHAPE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/*!
+ * Hidden class describing the field layout of instances.
+ * Shapes form a transition tree rooted at the class: adding a field
+ * moves an instance to the child shape for that name, so instances
+ * that get their fields in the same order share one shape and store
+ * their values in the same slots.
+ */
+class Shape {
+public:
+    /**
+     * Create empty root shape
+     */
+    Shape();
+
+    Shape(const Shape&) = delete;
+    Shape& operator=(const Shape&) = delete;
+
+    /**
+     * Find slot of a field
+     * @param name name of the field
+     * @return slot index, empty if the shape has no such field
+     */
+    [[nodiscard]] std::optional<std::size_t> lookup(std::string_view name) const;
+
+    /**
+     * Get shape with an additional field, created on first use
+     * @param name name of the new field, must not be part of this shape
+     * @return child shape, the new field occupies the last slot
+     */
+    Shape* addField(std::string_view name);
+
+    /**
+     * Get number of fields, i.e. slots an instance of this shape needs
+     * @return number of fields
+     */
+    [[nodiscard]] std::size_t getFieldCount() const;
+
+    /**
+     * Get identifier of the shape, unique for the lifetime of the process.
+     * Caches guard on it instead of the address, which may be reused
+     * once the class owning a shape is collected
+     * @return identifier, never zero
+     */
+    [[nodiscard]] std::uint64_t getId() const;
+
+private:
+    inline static std::uint64_t nextId_ = 1;
+    std::uint64_t id_;
+
+    // Field names in slot order
+    std::vector<std::string> fields_;
+
+    // Larger shapes are indexed, scanning a few names is faster than hashing
+    constexpr static std::size_t INDEX_THRESHOLD = 8;
+    std::unordered_map<std::string_view, std::size_t> index_;
+
+    // Transparent, so lookups by lexeme do not build a string
+    struct NameHash {
+        using is_transparent = void;
+        std::size_t operator()(std::string_view name) const { return std::hash<std::string_view>{}(name); }
+    };
+    std::unordered_map<std::string, std::unique_ptr<Shape>, NameHash, std::equal_to<>> transitions_;
+
+    Shape(const Shape& parent, std::string_view name);
+};
+
+
+#endif //LOX_SHAPE_H
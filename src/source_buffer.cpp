@@ -0,0 +1,82 @@
+#include "source_buffer.h"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+/**
+ * Read the rest of a file into a string
+ * @param fd file to read
+ * @param size_hint expected size, zero if unknown
+ * @param text string to append to
+ * @return false on read errors
+ */
+bool readAll(int fd, std::size_t size_hint, std::string& text) {
+    // Regular files are read with a single call, everything else in growing blocks until the end
+    constexpr std::size_t BLOCK_SIZE = 64 * 1024;
+    std::size_t size = 0;
+    // One spare byte lets the read that detects the end of a regular file succeed without growing
+    text.resize(size_hint ? size_hint + 1 : BLOCK_SIZE);
+
+    while (true) {
+        if (size == text.size()) { text.resize(text.size() * 2); }
+        const auto count = ::read(fd, text.data() + size, text.size() - size);
+        if (count < 0) {
+            if (errno == EINTR) { continue; }
+            return false;
+        }
+        if (count == 0) { break; }
+        size += static_cast<std::size_t>(count);
+    }
+
+    text.resize(size);
+    return true;
+}
+
+}
+
+std::unique_ptr<SourceBuffer> SourceBuffer::fromFile(const char* filename) {
+    const int fd = ::open(filename, O_RDONLY);
+    if (fd < 0) { return nullptr; }
+
+    std::unique_ptr<SourceBuffer> buffer{new SourceBuffer()};
+    struct stat info{};
+    const bool regular = ::fstat(fd, &info) == 0 && S_ISREG(info.st_mode);
+
+    if (regular && info.st_size > 0) {
+        const auto size = static_cast<std::size_t>(info.st_size);
+        void* mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED) {
+            // The scanner reads the file once from start to end
+            ::madvise(mapping, size, MADV_SEQUENTIAL);
+            buffer->mapping_ = mapping;
+            buffer->data_ = static_cast<const char*>(mapping);
+            buffer->size_ = size;
+            ::close(fd);
+            return buffer;
+        }
+    }
+
+    const bool success = readAll(fd, regular ? static_cast<std::size_t>(info.st_size) : 0, buffer->owned_);
+    ::close(fd);
+    if (!success) { return nullptr; }
+
+    buffer->data_ = buffer->owned_.data();
+    buffer->size_ = buffer->owned_.size();
+    return buffer;
+}
+
+SourceBuffer::SourceBuffer(std::string text) : owned_{std::move(text)} {
+    data_ = owned_.data();
+    size_ = owned_.size();
+}
+
+SourceBuffer::~SourceBuffer() {
+    if (mapping_) {
+        ::munmap(mapping_, size_);
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef LOX_SOURCE_BUFFER_H
+#define LOX_SOURCE_BUFFER_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+
+/*!
+ * Text of a Lox program. Scripts are mapped into memory, so loading them
+ * does not copy the file. Where mapping fails, e.g. for pipes, the file is
+ * read in bulk instead. Input that only exists in memory, like REPL lines,
+ * is owned by the buffer.
+ */
+class SourceBuffer {
+public:
+    /**
+     * Load script
+     * @param filename path of the script
+     * @return buffer with the contents of the file, null if it could not be opened or read
+     */
+    static std::unique_ptr<SourceBuffer> fromFile(const char* filename);
+
+    /**
+     * Create buffer owning its text
+     * @param text source text
+     */
+    explicit SourceBuffer(std::string text);
+
+    SourceBuffer(const SourceBuffer&) = delete;
+    SourceBuffer& operator=(const SourceBuffer&) = delete;
+
+    /**
+     * Unmaps mapped files
+     */
+    ~SourceBuffer();
+
+    /**
+     * Get source text, valid as long as the buffer
+     * @return source text
+     */
+    [[nodiscard]] std::string_view getText() const { return {data_, size_}; }
+
+    /**
+     * Check whether the text is a mapping of the file
+     * @return true if the file was mapped
+     */
+    [[nodiscard]] bool isMapped() const { return mapping_ != nullptr; }
+
+private:
+    std::string owned_;
+    void* mapping_ = nullptr;
+    const char* data_ = nullptr;
+    std::size_t size_ = 0;
+
+    SourceBuffer() = default;
+};
+
+
+#endif //LOX_SOURCE_BUFFER_H
@@ -45,6 +45,12 @@ public:
     virtual ~Statement() = default;
 
     virtual void accept(StatementVisitor& visitor) = 0;
+
+    /**
+     * Check whether the statement declares a name in the enclosing scope
+     * @return true for variable, function and class declarations
+     */
+    [[nodiscard]] virtual bool isDeclaration() const { return false; }
 };
 
 /**
@@ -52,7 +58,7 @@ public:
  */
 class VariableDeclaration : public Statement {
 public:
-    VariableDeclaration(std::unique_ptr<Expression> expression, Token token) : expression_(std::move(expression)),
+    VariableDeclaration(AstPtr<Expression> expression, Token token) : expression_(std::move(expression)),
                                                                                       token_(std::move(token)) {}
 
     ~VariableDeclaration() override = default;
@@ -61,7 +67,11 @@ public:
         visitor.visitVariableDeclaration(*this);
     }
 
-    [[nodiscard]] const std::unique_ptr<Expression>& getExpression() const {
+    [[nodiscard]] bool isDeclaration() const override {
+        return true;
+    }
+
+    [[nodiscard]] const AstPtr<Expression>& getExpression() const {
         return expression_;
     }
 
@@ -69,9 +79,14 @@ public:
         return token_;
     }
 
+    [[nodiscard]] VariableLocation& getLocation() {
+        return location_;
+    }
+
 private:
-    std::unique_ptr<Expression> expression_;
+    AstPtr<Expression> expression_;
     Token token_;
+    VariableLocation location_;
 };
 
 /**
@@ -79,7 +94,7 @@ private:
  */
 class ExpressionStatement : public Statement {
 public:
-    explicit ExpressionStatement(std::unique_ptr<Expression> expression) : expression_(std::move(expression)) {}
+    explicit ExpressionStatement(AstPtr<Expression> expression) : expression_(std::move(expression)) {}
 
     ~ExpressionStatement() override = default;
 
@@ -87,12 +102,12 @@ public:
         visitor.visitExpressionStatement(*this);
     }
 
-    [[nodiscard]] const std::unique_ptr<Expression>& getExpression() const {
+    [[nodiscard]] const AstPtr<Expression>& getExpression() const {
         return expression_;
     }
 
 private:
-    std::unique_ptr<Expression> expression_;
+    AstPtr<Expression> expression_;
 };
 
 /**
@@ -100,7 +115,7 @@ private:
  */
 class PrintStatement : public Statement {
 public:
-    explicit PrintStatement(std::unique_ptr<Expression> expression) : expression_(std::move(expression)) {}
+    explicit PrintStatement(AstPtr<Expression> expression) : expression_(std::move(expression)) {}
 
     ~PrintStatement() override = default;
 
@@ -108,12 +123,12 @@ public:
         visitor.visitPrintStatement(*this);
     }
 
-    [[nodiscard]] const std::unique_ptr<Expression>& getExpression() const {
+    [[nodiscard]] const AstPtr<Expression>& getExpression() const {
         return expression_;
     }
 
 private:
-    std::unique_ptr<Expression> expression_;
+    AstPtr<Expression> expression_;
 };
 
 /**
@@ -121,7 +136,7 @@ private:
  */
 class Block : public Statement {
 public:
-    explicit Block(std::vector<std::shared_ptr<Statement>>& statements) : statements_(statements) {}
+    explicit Block(std::vector<AstPtr<Statement>> statements) : statements_(std::move(statements)) {}
 
     ~Block() override = default;
 
@@ -129,12 +144,12 @@ public:
         visitor.visitBlock(*this);
     }
 
-    [[nodiscard]] std::vector<std::shared_ptr<Statement>>& getStatements() {
+    [[nodiscard]] std::vector<AstPtr<Statement>>& getStatements() {
         return statements_;
     }
 
 private:
-    std::vector<std::shared_ptr<Statement>> statements_;
+    std::vector<AstPtr<Statement>> statements_;
 };
 
 /**
@@ -142,9 +157,9 @@ private:
  */
 class IfStatement : public Statement {
 public:
-    IfStatement(std::unique_ptr<Expression> condition,
-                std::unique_ptr<Statement> thenBranch,
-                std::unique_ptr<Statement> elseBranch)
+    IfStatement(AstPtr<Expression> condition,
+                AstPtr<Statement> thenBranch,
+                AstPtr<Statement> elseBranch)
                 : condition_(std::move(condition)),
                   thenBranch_(std::move(thenBranch)),
                   elseBranch_(std::move(elseBranch)) {}
@@ -155,22 +170,22 @@ public:
         visitor.visitIfStatement(*this);
     }
 
-    [[nodiscard]] const std::unique_ptr<Expression>& getCondition() const {
+    [[nodiscard]] const AstPtr<Expression>& getCondition() const {
         return condition_;
     }
 
-    [[nodiscard]] const std::unique_ptr<Statement>& getThenBranch() const {
+    [[nodiscard]] const AstPtr<Statement>& getThenBranch() const {
         return thenBranch_;
     }
 
-    [[nodiscard]] const std::unique_ptr<Statement>& getElseBranch() const {
+    [[nodiscard]] const AstPtr<Statement>& getElseBranch() const {
         return elseBranch_;
     }
 
 private:
-    std::unique_ptr<Expression> condition_;
-    std::unique_ptr<Statement> thenBranch_;
-    std::unique_ptr<Statement> elseBranch_;
+    AstPtr<Expression> condition_;
+    AstPtr<Statement> thenBranch_;
+    AstPtr<Statement> elseBranch_;
 };
 
 /**
@@ -178,8 +193,8 @@ private:
  */
 class WhileStatement : public Statement {
 public:
-    WhileStatement(std::unique_ptr<Expression> condition,
-                   std::unique_ptr<Statement> thenBranch)
+    WhileStatement(AstPtr<Expression> condition,
+                   AstPtr<Statement> thenBranch)
                    : condition_(std::move(condition)),
                    thenBranch_(std::move(thenBranch)) {}
 
@@ -189,17 +204,17 @@ public:
         visitor.visitWhileStatement(*this);
     }
 
-    [[nodiscard]] const std::unique_ptr<Expression>& getCondition() const {
+    [[nodiscard]] const AstPtr<Expression>& getCondition() const {
         return condition_;
     }
 
-    [[nodiscard]] const std::unique_ptr<Statement>& getThenBranch() const {
+    [[nodiscard]] const AstPtr<Statement>& getThenBranch() const {
         return thenBranch_;
     }
 
 private:
-    std::unique_ptr<Expression> condition_;
-    std::unique_ptr<Statement> thenBranch_;
+    AstPtr<Expression> condition_;
+    AstPtr<Statement> thenBranch_;
 };
 
 /**
@@ -221,8 +236,8 @@ public:
  */
 class Function : public Statement {
 public:
-    Function(Token  name, std::vector<Token> params, std::vector<std::shared_ptr<Statement>>& body)
-    : name_(std::move(name)), params_(std::move(params)), body_(body)
+    Function(Token  name, std::vector<Token> params, std::vector<AstPtr<Statement>> body)
+    : name_(std::move(name)), prototype_{std::move(params), std::move(body)}
     {}
 
     ~Function() override = default;
@@ -231,22 +246,37 @@ public:
         visitor.visitFunction(*this);
     }
 
+    [[nodiscard]] bool isDeclaration() const override {
+        return true;
+    }
+
     [[nodiscard]] const Token& getName() const {
         return name_;
     }
 
     [[nodiscard]] const std::vector<Token>& getParams() const {
-        return params_;
+        return prototype_.params;
+    }
+
+    [[nodiscard]] std::vector<AstPtr<Statement>>& getBody() {
+        return prototype_.body;
     }
 
-    [[nodiscard]] std::vector<std::shared_ptr<Statement>>& getBody() {
-        return body_;
+    [[nodiscard]] FunctionPrototype& getPrototype() {
+        return prototype_;
+    }
+
+    /**
+     * Location of the variable the function is stored in
+     */
+    [[nodiscard]] VariableLocation& getLocation() {
+        return location_;
     }
 
 private:
     Token name_;
-    std::vector<Token> params_;
-    std::vector<std::shared_ptr<Statement>> body_;
+    FunctionPrototype prototype_;
+    VariableLocation location_;
 };
 
 /**
@@ -254,7 +284,7 @@ private:
  */
 class Return : public Statement {
 public:
-    Return(Token  keyword, std::unique_ptr<Expression> value)
+    Return(Token  keyword, AstPtr<Expression> value)
         : keyword_(std::move(keyword)), value_(std::move(value))
     {}
 
@@ -268,13 +298,13 @@ public:
         return keyword_;
     }
 
-    [[nodiscard]] const std::unique_ptr<Expression>& getValue() const {
+    [[nodiscard]] const AstPtr<Expression>& getValue() const {
         return value_;
     }
 
 private:
     Token keyword_;
-    std::unique_ptr<Expression> value_;
+    AstPtr<Expression> value_;
 };
 
 /**
@@ -282,12 +312,12 @@ private:
  */
 class ClassDeclaration : public Statement {
 public:
-    ClassDeclaration(Token  name, std::vector<std::shared_ptr<Function>> methods)
+    ClassDeclaration(Token  name, std::vector<AstPtr<Function>> methods)
         : name_{std::move(name)}, methods_(std::move(methods)), superclass_(nullptr)
     {}
 
-    ClassDeclaration(Token  name, std::vector<std::shared_ptr<Function>> methods,
-                     std::unique_ptr<VariableAccess> superclass)
+    ClassDeclaration(Token  name, std::vector<AstPtr<Function>> methods,
+                     AstPtr<VariableAccess> superclass)
             : name_{std::move(name)}, methods_(std::move(methods)), superclass_(std::move(superclass))
     {}
 
@@ -297,22 +327,42 @@ public:
         visitor.visitClassDeclaration(*this);
     }
 
+    [[nodiscard]] bool isDeclaration() const override {
+        return true;
+    }
+
     [[nodiscard]] const Token& getName() const {
         return name_;
     }
 
-    [[nodiscard]] const std::vector<std::shared_ptr<Function>>& getMethods() const {
+    [[nodiscard]] const std::vector<AstPtr<Function>>& getMethods() const {
         return methods_;
     }
 
-    [[nodiscard]] const std::unique_ptr<VariableAccess>& getSuperclass() const {
+    [[nodiscard]] const AstPtr<VariableAccess>& getSuperclass() const {
         return superclass_;
     }
 
+    /**
+     * Location of the variable the class is stored in
+     */
+    [[nodiscard]] VariableLocation& getLocation() {
+        return location_;
+    }
+
+    /**
+     * Location of super, a local of the scope enclosing the methods
+     */
+    [[nodiscard]] VariableLocation& getSuperLocation() {
+        return superLocation_;
+    }
+
 private:
     Token name_;
-    std::vector<std::shared_ptr<Function>> methods_;
-    std::unique_ptr<VariableAccess> superclass_;
+    std::vector<AstPtr<Function>> methods_;
+    AstPtr<VariableAccess> superclass_;
+    VariableLocation location_;
+    VariableLocation superLocation_;
 };
 
 #endif //LOX_STATEMENTS_H
@@ -0,0 +1,50 @@
+#include "string_table.h"
+#include "types.h"
+
+#include <algorithm>
+
+LoxString* StringTable::find(std::string_view chars, std::size_t hash) const {
+    if (entries_.empty()) { return nullptr; }
+
+    const auto mask = entries_.size() - 1;
+    for (auto index = hash & mask; ; index = (index + 1) & mask) {
+        const Entry& entry = entries_[index];
+        if (!entry.string) { return nullptr; }
+        if (entry.hash == hash && entry.string != tombstone() && entry.string->getValue() == chars) {
+            return entry.string;
+        }
+    }
+}
+
+void StringTable::insert(LoxString* string) {
+    if ((used_ + 1) * 4 > entries_.size() * 3) { grow(); }
+
+    const auto mask = entries_.size() - 1;
+    auto index = string->getHash() & mask;
+    while (entries_[index].string && entries_[index].string != tombstone()) {
+        index = (index + 1) & mask;
+    }
+
+    if (!entries_[index].string) { used_++; }
+    entries_[index] = Entry{string, string->getHash()};
+    size_++;
+}
+
+LoxString* StringTable::tombstone() {
+    // Never dereferenced, only compared against
+    static char sentinel;
+    return reinterpret_cast<LoxString*>(&sentinel);
+}
+
+void StringTable::grow() {
+    // Rebuilding drops the tombstones, the capacity only grows if the live entries need it
+    std::vector<Entry> entries = std::move(entries_);
+    const auto capacity = size_ * 2 >= entries.size() ? entries.size() * 2 : entries.size();
+    entries_.assign(std::max(MIN_CAPACITY, capacity), Entry{});
+    size_ = 0;
+    used_ = 0;
+
+    for (const Entry& entry : entries) {
+        if (entry.string && entry.string != tombstone()) { insert(entry.string); }
+    }
+}
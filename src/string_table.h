@@ -0,0 +1,70 @@
+#ifndef LOX_STRING_TABLE_H
+#define LOX_STRING_TABLE_H
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+class LoxString;
+
+/*!
+ * Set of all interned strings, every distinct content exists at most once.
+ * Open addressing with linear probing. Entries keep a copy of the cached
+ * hash of their string, so probing only touches the table itself. The table does not keep its strings alive, the heap removes
+ * unreachable ones before it frees them.
+ */
+class StringTable {
+public:
+    /**
+     * Find string with the given content
+     * @param chars content of the string
+     * @param hash hash of the content, see LoxString::hashOf
+     * @return interned string, null if there is none
+     */
+    [[nodiscard]] LoxString* find(std::string_view chars, std::size_t hash) const;
+
+    /**
+     * Add string, its content must not be interned yet
+     * @param string string to add
+     */
+    void insert(LoxString* string);
+
+    /**
+     * Remove all strings matching a predicate
+     * @param predicate called for every string, returns true to remove it
+     */
+    template<typename Predicate>
+    void removeIf(Predicate predicate) {
+        for (auto& entry : entries_) {
+            if (entry.string && entry.string != tombstone() && predicate(entry.string)) {
+                entry.string = tombstone();
+                size_--;
+            }
+        }
+    }
+
+    /**
+     * Get number of interned strings
+     * @return number of strings
+     */
+    [[nodiscard]] std::size_t size() const { return size_; }
+
+private:
+    constexpr static std::size_t MIN_CAPACITY = 64;
+
+    struct Entry {
+        LoxString* string = nullptr;
+        std::size_t hash = 0;
+    };
+
+    // Capacity is a power of two. Removed entries stay as tombstones to keep probe sequences intact
+    std::vector<Entry> entries_;
+    std::size_t size_ = 0;
+    std::size_t used_ = 0; // Live entries and tombstones
+
+    static LoxString* tombstone();
+    void grow();
+};
+
+
+#endif //LOX_STRING_TABLE_H
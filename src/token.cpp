@@ -4,27 +4,34 @@
 
 #include "token.h"
 
+#include "types.h"
 #include "utils.h"
 
+// Scanning large sources copies many tokens around
+static_assert(sizeof(Token) <= 24);
+
 Token::Token(const TokenType type, std::string_view lexeme, int line)
-    : type_{type}, lexeme_{lexeme}, line_{line},  literal_{std::monostate{}} {}
+    : lexeme_{lexeme.data()}, literal_{.string = nullptr}, length_{static_cast<std::uint32_t>(lexeme.size())},
+      type_{static_cast<std::uint32_t>(type)}, line_{line} {}
 
-Token::Token(TokenType type, std::string_view lexeme, int line, std::string_view value)
-    : type_{type}, lexeme_{lexeme}, line_{line}, literal_{std::string{value}} {}
+Token::Token(TokenType type, std::string_view lexeme, int line, LoxString* value)
+    : lexeme_{lexeme.data()}, literal_{.string = value}, length_{static_cast<std::uint32_t>(lexeme.size())},
+      type_{static_cast<std::uint32_t>(type)}, line_{line} {}
 
 Token::Token(TokenType type, std::string_view lexeme, int line, double value)
-    : type_{type}, lexeme_{lexeme}, line_{line}, literal_{value} {}
+    : lexeme_{lexeme.data()}, literal_{.number = value}, length_{static_cast<std::uint32_t>(lexeme.size())},
+      type_{static_cast<std::uint32_t>(type)}, line_{line} {}
 
 std::ostream &operator<<(std::ostream &os, const Token &t) {
-    os << "[" << t.type_ << ", " << "Line " << t.line_ << ", Lexeme " << t.lexeme_;
+    os << "[" << t.getType() << ", " << "Line " << t.line_ << ", Lexeme " << t.getLexeme();
 
     // Print depending on which type of literal we have
     // The syntax for pattern matching is kind of weird, but it works
     std::visit(overload{
         [&](double d) { os << ", Literal " << d; },
-        [&](const std::string& s) { os << ", Literal " << s; },
+        [&](const LoxString* s) { os << ", Literal " << s->getValue(); },
         [](std::monostate) { },
-    }, t.literal_);
+    }, t.getLiteral());
 
     os << "]";
 
@@ -32,15 +39,19 @@ std::ostream &operator<<(std::ostream &os, const Token &t) {
 }
 
 TokenType Token::getType() const {
-    return type_;
+    return static_cast<TokenType>(type_);
 }
 
-const std::variant<std::monostate, double, std::string> &Token::getLiteral() const {
-    return literal_;
+std::variant<std::monostate, double, LoxString*> Token::getLiteral() const {
+    switch (getType()) {
+        case TokenType::NUMBER: return literal_.number;
+        case TokenType::STRING: return literal_.string;
+        default: return std::monostate{};
+    }
 }
 
-const std::string& Token::getLexeme() const {
-    return lexeme_;
+std::string_view Token::getLexeme() const {
+    return {lexeme_, length_};
 }
 
 int Token::getLine() const {
@@ -48,7 +59,7 @@ int Token::getLine() const {
 }
 
 bool Token::operator==(const Token& rhs) const {
-    return lexeme_ == rhs.lexeme_;
+    return getLexeme() == rhs.getLexeme();
 }
 
 bool Token::operator!=(const Token& rhs) const {
@@ -7,14 +7,22 @@
 
 #include "token_type.h"
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
 #include <string_view>
 #include <optional>
 #include <variant>
 #include <iostream>
 
+class LoxString;
+
 /*!
- * Class representing tokens
+ * Class representing tokens.
+ * Tokens do not own their lexeme, it is a view into the source buffer
+ * (or a string literal for tokens made up by the compiler), which has to
+ * outlive the token. The literal is stored in a union tagged by the token type,
+ * which keeps tokens at 24 bytes.
  */
 class Token {
 public:
@@ -40,14 +48,17 @@ public:
      * @param type token type
      * @param lexeme lexeme
      * @param line line number
-     * @param value string value of token
+     * @param value interned string value of token
      */
-    Token(TokenType type, std::string_view lexeme, int line, std::string_view value);
+    Token(TokenType type, std::string_view lexeme, int line, LoxString* value);
+
+    // Longest lexeme a token can refer to
+    constexpr static std::size_t MAX_LEXEME_LENGTH = (std::size_t{1} << 24) - 1;
 
     // Getters for attributes
     [[nodiscard]] TokenType getType() const;
-    [[nodiscard]] const std::variant<std::monostate, double, std::string>& getLiteral() const;
-    [[nodiscard]] const std::string& getLexeme() const;
+    [[nodiscard]] std::variant<std::monostate, double, LoxString*> getLiteral() const;
+    [[nodiscard]] std::string_view getLexeme() const;
     [[nodiscard]] int getLine() const;
 
     // Overloads for hash map
@@ -56,10 +67,14 @@ public:
     bool operator!=(const Token& rhs) const;
 
 private:
-    const TokenType type_;
-    const std::string lexeme_;
-    const int line_;
-    const std::variant<std::monostate, double, std::string> literal_;
+    const char* lexeme_;
+    union {
+        double number;      // NUMBER tokens
+        LoxString* string;  // STRING tokens
+    } literal_;
+    std::uint32_t length_ : 24;
+    std::uint32_t type_ : 8;
+    int line_;
 
     friend std::ostream& operator<<(std::ostream& os, const Token& t);
 };
@@ -78,15 +93,7 @@ namespace std {
     {
         std::size_t operator()(const Token& k) const
         {
-            using std::size_t;
-            using std::hash;
-            using std::string;
-
-            // Compute individual hash values for first,
-            // second and third and combine them using XOR
-            // and bit shifting:
-
-            return ((hash<string>()(k.getLexeme())));
+            return hash<string_view>()(k.getLexeme());
         }
     };
 }
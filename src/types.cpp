@@ -4,33 +4,88 @@
 
 #include "types.h"
 #include "loxinstance.h"
+#include "heap.h"
 
-std::string stringify(const LoxType& l) {
-    std::string return_value;
-
-    std::visit(overload{
-            [&](double d) {
-                return_value = std::to_string(d);
-            },
-            [&](const std::string &s) {
-                return_value = s;
-            },
-            [&](const NullType &n) {
-                return_value = "nil";
-            },
-            [&](bool b) {
-                return_value = std::to_string(b);
-            },
-            [&](const std::shared_ptr<Callable>& c) {
-                return_value = std::to_string(reinterpret_cast<std::uintptr_t>(c.get()));
-            },
-            [&](const std::shared_ptr<LoxClass>& s) {
-                return_value = s->getName();
-            },
-            [&](const std::shared_ptr<LoxInstance>& s) {
-                return_value = s->getClass()->getName() + " instance";
-            }
-    }, l);
-
-    return return_value;
+#include <charconv>
+#include <vector>
+
+void LoxString::trace(Heap& heap) {
+    heap.markObject(left_);
+    heap.markObject(right_);
+}
+
+void LoxString::flatten() const {
+    value_.reserve(length_);
+
+    // Ropes built by appending are deep, so the parts are collected without recursion
+    std::vector<const LoxString*> pending{right_, left_};
+    while (!pending.empty()) {
+        const LoxString* part = pending.back();
+        pending.pop_back();
+        if (part->left_) {
+            pending.push_back(part->right_);
+            pending.push_back(part->left_);
+        } else {
+            value_.append(part->value_);
+        }
+    }
+
+    left_ = nullptr;
+    right_ = nullptr;
+
+    // Flattening is the only time a string's contents change
+    heap_->updatePayload(const_cast<LoxString*>(this));
+}
+
+NumberText formatNumber(double value, NumberFormat format) {
+    NumberText text;
+    auto* first = text.buffer.data();
+    auto* last = first + text.buffer.size();
+
+    // Both notations match printf in the C locale, the buffer fits every double
+    auto result = format == NumberFormat::FIXED ? std::to_chars(first, last, value, std::chars_format::fixed, 6)
+                                                : std::to_chars(first, last, value);
+    text.length = static_cast<std::size_t>(result.ptr - first);
+    return text;
+}
+
+void printValue(std::ostream& os, const LoxType& l, NumberFormat format) {
+    if (l.isNumber()) {
+        auto text = formatNumber(l.asNumber(), format);
+        os.write(text.buffer.data(), static_cast<std::streamsize>(text.length));
+        return;
+    }
+    if (l.isString()) {
+        os << l.asString();
+        return;
+    }
+    os << stringify(l, format);
+}
+
+std::string stringify(const LoxType& l, NumberFormat format) {
+    if (l.isNumber()) {
+        return std::string{formatNumber(l.asNumber(), format).view()};
+    }
+    if (l.isNil()) {
+        return "nil";
+    }
+    if (l.isBool()) {
+        return std::to_string(l.asBool());
+    }
+
+    switch (l.asObj()->getType()) {
+        case ObjType::STRING:
+            return l.asString();
+        case ObjType::CLASS:
+            return l.as<LoxClass>()->getName();
+        case ObjType::INSTANCE:
+            return l.as<LoxInstance>()->getClass()->getName() + " instance";
+        case ObjType::FUNCTION:
+        case ObjType::NATIVE:
+        case ObjType::ENVIRONMENT:
+        case ObjType::UPVALUE:
+            break;
+    }
+
+    return std::to_string(reinterpret_cast<std::uintptr_t>(l.asObj()));
 }
@@ -8,7 +8,15 @@
 #include "token.h"
 #include "utils.h"
 
+#include <array>
+#include <cstdint>
+#include <cstring>
 #include <memory>
+#include <ostream>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
 #include <vector>
 #include <utility>
 
@@ -16,30 +24,263 @@
  * Represents null values
  */
 class NullType {};
-class Callable;
 class Interpreter;
-class LoxClass;
-class LoxInstance;
+
+class Heap;
+
+/*!
+ * Kinds of heap objects, stored in the object header
+ */
+enum class ObjType : std::uint8_t {
+    STRING,
+    FUNCTION,
+    NATIVE,
+    CLASS,
+    INSTANCE,
+    ENVIRONMENT,
+    UPVALUE
+};
+
+/*!
+ * Common header of all heap allocated Lox objects.
+ * Objects are owned by the Heap, which links them into a list
+ * and frees them once they are no longer reachable from a root.
+ */
+class Obj {
+public:
+    explicit Obj(ObjType type) : type_{type} {}
+
+    Obj(const Obj&) = delete;
+    Obj& operator=(const Obj&) = delete;
+
+    virtual ~Obj() = default;
+
+    [[nodiscard]] ObjType getType() const { return type_; }
+
+    /*!
+     * Mark all objects referenced by this one
+     * @param heap heap performing the collection
+     */
+    virtual void trace(Heap&) {}
+
+    /*!
+     * Get size of the memory the object owns outside of itself, e.g. the characters of a string.
+     * The heap counts it towards the collection threshold
+     * @return size in bytes
+     */
+    [[nodiscard]] virtual std::size_t payloadSize() const { return 0; }
+
+private:
+    ObjType type_;
+    bool marked_ = false;
+    bool permanent_ = false;
+    std::uint32_t size_ = 0;
+    Obj* next_ = nullptr;
+    std::size_t payload_ = 0; // Payload size the heap currently accounts for
+
+    friend class Heap;
+};
+
+/*!
+ * Lox string objects. Strings are immutable. Flat strings are interned by
+ * the heap, so equal flat strings are the same object and compare by identity.
+ * Long concatenations produce ropes instead, which only reference their two
+ * halves and are flattened the first time their contents are needed.
+ * Appending to a string in a loop thereby stays linear in the final length.
+ */
+class LoxString : public Obj {
+public:
+    // Concatenations at least this long become ropes
+    constexpr static std::size_t MIN_ROPE_LENGTH = 256;
+
+    /**
+     * Create interned flat string, only used by the heap
+     * @param value contents
+     * @param hash hash of the contents
+     */
+    LoxString(std::string value, std::size_t hash)
+        : Obj(ObjType::STRING), value_{std::move(value)}, length_{value_.size()}, hash_{hash}, interned_{true} {}
+
+    /**
+     * Create rope node
+     * @param left first part
+     * @param right second part
+     * @param heap heap owning the rope, accounts for the contents once they are flattened
+     */
+    LoxString(LoxString* left, LoxString* right, Heap& heap)
+        : Obj(ObjType::STRING), length_{left->length_ + right->length_}, heap_{&heap}, left_{left}, right_{right} {}
+
+    /**
+     * Get contents, flattens ropes
+     * @return contents
+     */
+    [[nodiscard]] const std::string& getValue() const {
+        if (left_) { flatten(); }
+        return value_;
+    }
+
+    [[nodiscard]] std::size_t getLength() const { return length_; }
+
+    /**
+     * Check whether the string is interned, otherwise it is a rope
+     * or the flattened contents of one
+     * @return true for interned strings
+     */
+    [[nodiscard]] bool isInterned() const { return interned_; }
+
+    /**
+     * Get hash of the contents, only available for interned strings
+     * @return hash
+     */
+    [[nodiscard]] std::size_t getHash() const { return hash_; }
+
+    /**
+     * Hash of string contents, computed once per string and cached
+     * @param chars contents
+     * @return hash value
+     */
+    [[nodiscard]] static std::size_t hashOf(std::string_view chars) { return std::hash<std::string_view>{}(chars); }
+
+    void trace(Heap& heap) override;
+
+    [[nodiscard]] std::size_t payloadSize() const override { return value_.capacity(); }
+
+private:
+    // Ropes fill in value_ and drop their parts when they are flattened
+    mutable std::string value_;
+    const std::size_t length_;
+    // Interned strings cache their hash, ropes never need one
+    union {
+        const std::size_t hash_ = 0;
+        Heap* const heap_;
+    };
+    const bool interned_ = false;
+    mutable LoxString* left_ = nullptr;
+    mutable LoxString* right_ = nullptr;
+
+    void flatten() const;
+};
 
 /*!
- * Representation of the types a Lox expression can return
+ * Representation of the values a Lox expression can return.
+ * A value is a 64 bit NaN-boxed word: doubles are stored as they are,
+ * nil, booleans and object pointers are encoded in the payload
+ * of a quiet NaN that arithmetic never produces.
  */
-using LoxType = std::variant<double,
-                             std::string,
-                             bool,
-                             NullType,
-                             std::shared_ptr<Callable>,
-                             std::shared_ptr<LoxClass>,
-                             std::shared_ptr<LoxInstance>>;
+class LoxType {
+public:
+    LoxType() : bits_{NIL_VALUE} {}
+    LoxType(NullType) : bits_{NIL_VALUE} {} // NOLINT: implicit conversions mirror the Lox types
+    LoxType(double d) { std::memcpy(&bits_, &d, sizeof(double)); } // NOLINT
+    LoxType(bool b) : bits_{b ? TRUE_VALUE : FALSE_VALUE} {} // NOLINT
+
+    LoxType(Obj* object) : bits_{SIGN_BIT | QNAN | reinterpret_cast<std::uintptr_t>(object)} {} // NOLINT
+
+    [[nodiscard]] bool isNumber() const { return (bits_ & QNAN) != QNAN; }
+    [[nodiscard]] bool isNil() const { return bits_ == NIL_VALUE; }
+    [[nodiscard]] bool isBool() const { return (bits_ | 1) == TRUE_VALUE; }
+    [[nodiscard]] bool isObj() const { return (bits_ & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT); }
+
+    [[nodiscard]] bool isObjType(ObjType type) const {
+        return isObj() && asObj()->getType() == type;
+    }
+
+    [[nodiscard]] bool isString() const { return isObjType(ObjType::STRING); }
+
+    [[nodiscard]] bool isCallable() const {
+        if (!isObj()) { return false; }
+        auto type = asObj()->getType();
+        return type == ObjType::FUNCTION || type == ObjType::NATIVE || type == ObjType::CLASS;
+    }
+
+    [[nodiscard]] double asNumber() const {
+        double d;
+        std::memcpy(&d, &bits_, sizeof(double));
+        return d;
+    }
+
+    [[nodiscard]] bool asBool() const { return bits_ == TRUE_VALUE; }
+
+    [[nodiscard]] Obj* asObj() const {
+        return reinterpret_cast<Obj*>(static_cast<std::uintptr_t>(bits_ & ~(SIGN_BIT | QNAN)));
+    }
 
-class Callable {
+    template<typename T>
+    [[nodiscard]] T* as() const { return static_cast<T*>(asObj()); }
+
+    [[nodiscard]] const std::string& asString() const { return as<LoxString>()->getValue(); }
+
+    /*!
+     * Compare raw representation, i.e. identity for objects
+     */
+    [[nodiscard]] bool identical(const LoxType& other) const { return bits_ == other.bits_; }
+
+private:
+    static constexpr std::uint64_t SIGN_BIT = 0x8000000000000000;
+    static constexpr std::uint64_t QNAN = 0x7ffc000000000000;
+    static constexpr std::uint64_t NIL_VALUE = QNAN | 1;
+    static constexpr std::uint64_t FALSE_VALUE = QNAN | 2;
+    static constexpr std::uint64_t TRUE_VALUE = QNAN | 3;
+
+    std::uint64_t bits_;
+};
+
+static_assert(sizeof(LoxType) == sizeof(std::uint64_t), "Values have to fit into a machine word");
+static_assert(std::is_trivially_copyable_v<LoxType>, "Values are copied without touching the heap");
+
+/*!
+ * Arguments of a call, a view of the values the caller evaluated onto its stack.
+ * They stay there, and thereby rooted, until the call returns
+ */
+using Arguments = std::span<const LoxType>;
+
+/*!
+ * Interface of everything that can be called: functions, classes and natives
+ */
+class Callable : public Obj {
 public:
-    virtual LoxType call(Interpreter& interpreter, std::vector<LoxType>& arguments) = 0;
+    explicit Callable(ObjType type) : Obj(type) {}
+    virtual LoxType call(Interpreter& interpreter, Arguments arguments) = 0;
     virtual int arity() = 0;
-    virtual ~Callable() = default;
+    ~Callable() override = default;
+};
+
+/**
+ * Text representations of numbers
+ */
+enum class NumberFormat {
+    FIXED,   // Six decimals, like printf("%f")
+    SHORTEST // Shortest text that reads back as the same number, e.g. 0.1 or 42
+};
+
+/*!
+ * Formatted number, kept in a buffer of its own instead of an allocated string
+ */
+struct NumberText {
+    // Fixed notation of the largest doubles has 309 integer digits, a sign and six decimals
+    std::array<char, 328> buffer;
+    std::size_t length = 0;
+
+    [[nodiscard]] std::string_view view() const { return {buffer.data(), length}; }
 };
 
-std::string stringify(const LoxType &l);
+/**
+ * Format number without going through the locale
+ * @param value number to format
+ * @param format text representation
+ * @return formatted number
+ */
+NumberText formatNumber(double value, NumberFormat format);
+
+std::string stringify(const LoxType &l, NumberFormat format = NumberFormat::FIXED);
+
+/**
+ * Write value like stringify, without copying strings
+ * @param os stream to write to
+ * @param l value to write
+ * @param format text representation of numbers
+ */
+void printValue(std::ostream& os, const LoxType& l, NumberFormat format);
 
 
 #endif //LOX_TYPES_H
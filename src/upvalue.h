@@ -0,0 +1,34 @@
+#ifndef LOX_UPVALUE_H
+#define LOX_UPVALUE_H
+
+#include "types.h"
+#include "heap.h"
+
+/*!
+ * Heap cell holding a local variable captured by a closure.
+ * The declaring call keeps the cell in the variable's register and
+ * every closure capturing the variable shares the same cell, so
+ * assignments are visible to all of them
+ */
+class Upvalue : public Obj {
+public:
+    /**
+     * Constructor
+     * @param value initial value of the variable
+     */
+    explicit Upvalue(LoxType value) : Obj(ObjType::UPVALUE), value_{value} {}
+
+    [[nodiscard]] const LoxType& get() const { return value_; }
+
+    void set(LoxType value) { value_ = value; }
+
+    void trace(Heap& heap) override {
+        heap.markValue(value_);
+    }
+
+private:
+    LoxType value_;
+};
+
+
+#endif //LOX_UPVALUE_H
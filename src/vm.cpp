@@ -0,0 +1,464 @@
+#include "vm.h"
+
+#include "interpreter.h"
+#include "loxfunction.h"
+#include "loxclass.h"
+#include "loxinstance.h"
+#include "upvalue.h"
+
+#include <functional>
+
+VM::VM(Interpreter& interpreter)
+    : interpreter_{interpreter}
+{
+}
+
+void VM::interpret(const Chunk& script, std::size_t slot_count) {
+    const auto base_frame = frames_.size();
+    const auto base_stack = stack_.size();
+
+    stack_.resize(base_stack + slot_count);
+    frames_.push_back(CallFrame{&script, script.code.data(), nullptr, base_stack, base_stack, nullptr});
+
+    try {
+        run(base_frame);
+    } catch (...) {
+        frames_.erase(frames_.begin() + static_cast<std::ptrdiff_t>(base_frame), frames_.end());
+        stack_.resize(base_stack);
+        throw;
+    }
+}
+
+LoxType VM::call(LoxFunction* function, LoxInstance* receiver, Arguments arguments) {
+    const auto base_frame = frames_.size();
+    const auto base_stack = stack_.size();
+
+    // The arguments may be a view of this stack, which is about to grow
+    const auto count = arguments.size();
+    const bool on_stack = count && std::less_equal<>{}(stack_.data(), arguments.data()) &&
+                          std::less<>{}(arguments.data(), stack_.data() + stack_.size());
+    const auto source = on_stack ? static_cast<std::size_t>(arguments.data() - stack_.data()) : 0;
+
+    stack_.emplace_back(function);
+    stack_.resize(base_stack + 1 + count);
+    for (std::size_t i = 0; i < count; ++i) {
+        stack_[base_stack + 1 + i] = on_stack ? stack_[source + i] : arguments[i];
+    }
+    pushFrame(function, static_cast<int>(arguments.size()), receiver);
+
+    try {
+        return run(base_frame);
+    } catch (...) {
+        frames_.erase(frames_.begin() + static_cast<std::ptrdiff_t>(base_frame), frames_.end());
+        stack_.resize(base_stack);
+        throw;
+    }
+}
+
+void VM::markRoots(Heap& heap) {
+    for (const auto& value : stack_) {
+        heap.markValue(value);
+    }
+    for (const auto& frame : frames_) {
+        heap.markObject(frame.function);
+        heap.markObject(frame.receiver);
+    }
+}
+
+void VM::collectGarbageIfNeeded() {
+    if (interpreter_.heap_.shouldCollect()) {
+        interpreter_.collectGarbage();
+    }
+}
+
+LoxType VM::pop() {
+    LoxType value = std::move(stack_.back());
+    stack_.pop_back();
+    return value;
+}
+
+void VM::pushFrame(LoxFunction* function, int arg_count, LoxInstance* receiver) {
+    // Arguments already sit in the parameter registers. Methods get this
+    // in the first register, which replaces the callee
+    const auto callee = stack_.size() - arg_count - 1;
+    auto slots = callee + 1;
+    if (function->isMethod()) {
+        slots = callee;
+        stack_[callee] = receiver;
+    }
+
+    const FunctionCode& code = *function->getCode();
+    stack_.resize(slots + code.slotCount);
+    for (auto captured : code.capturedParameters) {
+        stack_[slots + captured] = interpreter_.heap_.allocate<Upvalue>(stack_[slots + captured]);
+    }
+
+    const Chunk* chunk = code.chunk.get();
+    frames_.push_back(CallFrame{chunk, chunk->code.data(), function, slots, callee, receiver});
+}
+
+LoxFunction* VM::makeClosure(const std::shared_ptr<FunctionCode>& code, FunctionKind kind) {
+    const CallFrame& frame = frames_.back();
+    std::vector<Upvalue*> upvalues;
+    upvalues.reserve(code->upvalues.size());
+    for (const auto& upvalue : code->upvalues) {
+        if (upvalue.local) {
+            upvalues.push_back(stack_[frame.slots + upvalue.index].as<Upvalue>());
+        } else {
+            upvalues.push_back(frame.function->getUpvalue(upvalue.index));
+        }
+    }
+    return interpreter_.heap_.allocate<LoxFunction>(code, std::move(upvalues), kind);
+}
+
+void VM::callValue(LoxType callee, int arg_count, const Token& paren) {
+    Callable* callable;
+    LoxInstance* instance = nullptr;
+
+    if (callee.isObjType(ObjType::CLASS)) {
+        auto* klass = callee.as<LoxClass>();
+        instance = interpreter_.heap_.allocate<LoxInstance>(klass);
+
+        auto initializer = klass->getMethod(Token(TokenType::IDENTIFIER, "init", 0));
+        if (!initializer) {
+            if (arg_count != 0) {
+                throw RuntimeError(paren, "Expected 0 arguments but got " + std::to_string(arg_count) + ".");
+            }
+            stack_.back() = instance;
+            return;
+        }
+        callable = initializer;
+    } else if (callee.isCallable()) {
+        callable = callee.as<Callable>();
+    } else {
+        throw RuntimeError(paren, "Can only call functions and classes.");
+    }
+
+    if (arg_count != callable->arity()) {
+        throw RuntimeError(paren, "Expected " +
+                                  std::to_string(callable->arity()) + " arguments but got " +
+                                  std::to_string(arg_count) + ".");
+    }
+
+    // Compiled functions run in this loop, everything else is called natively
+    if (callable->getType() == ObjType::FUNCTION) {
+        auto* function = static_cast<LoxFunction*>(callable);
+        if (function->getCode()) {
+            // The initializer of a class runs on the new instance
+            pushFrame(function, arg_count, instance ? instance : function->getReceiver());
+            return;
+        }
+    }
+
+    const auto first_argument = stack_.size() - arg_count;
+    LoxType result = callable->call(interpreter_, Arguments{stack_.data() + first_argument,
+                                                           static_cast<std::size_t>(arg_count)});
+    stack_.resize(first_argument - 1);
+    if (instance) {
+        stack_.emplace_back(instance);
+    } else {
+        stack_.push_back(std::move(result));
+    }
+}
+
+void VM::invoke(const Token& name, const Token& paren, PropertyCache& cache, int arg_count) {
+    const auto receiver_slot = stack_.size() - arg_count - 1;
+    if (!stack_[receiver_slot].isObjType(ObjType::INSTANCE)) {
+        throw RuntimeError(name, "Only instances have properties.");
+    }
+
+    auto* receiver = stack_[receiver_slot].as<LoxInstance>();
+    LoxType field;
+    auto* method = interpreter_.lookUpProperty(receiver, name, cache, field);
+    if (!method) {
+        // Fields holding functions are called like any other value
+        stack_[receiver_slot] = field;
+        callValue(field, arg_count, paren);
+        return;
+    }
+
+    if (arg_count != method->arity()) {
+        throw RuntimeError(paren, "Expected " +
+                                  std::to_string(method->arity()) + " arguments but got " +
+                                  std::to_string(arg_count) + ".");
+    }
+    pushFrame(method, arg_count, receiver);
+}
+
+LoxType VM::run(std::size_t base_frame) {
+    const Chunk* chunk = frames_.back().chunk;
+    const std::uint8_t* ip = frames_.back().ip;
+    std::size_t slots = frames_.back().slots;
+
+    while (true) {
+        const auto op = static_cast<OpCode>(*ip++);
+
+        switch (op) {
+            case OpCode::CONSTANT:
+                stack_.push_back(chunk->constants[readOperand<std::uint32_t>(ip)]);
+                break;
+            case OpCode::NIL:
+                stack_.emplace_back(NullType{});
+                break;
+            case OpCode::TRUE:
+                stack_.emplace_back(true);
+                break;
+            case OpCode::FALSE:
+                stack_.emplace_back(false);
+                break;
+            case OpCode::POP:
+                stack_.pop_back();
+                break;
+
+            case OpCode::GET_LOCAL: {
+                LoxType value = stack_[slots + readOperand<std::uint16_t>(ip)];
+                stack_.push_back(value);
+                break;
+            }
+            case OpCode::SET_LOCAL:
+                stack_[slots + readOperand<std::uint16_t>(ip)] = stack_.back();
+                break;
+            case OpCode::DEFINE_LOCAL:
+                stack_[slots + readOperand<std::uint16_t>(ip)] = pop();
+                break;
+            case OpCode::GET_CAPTURED: {
+                LoxType value = stack_[slots + readOperand<std::uint16_t>(ip)].as<Upvalue>()->get();
+                stack_.push_back(value);
+                break;
+            }
+            case OpCode::SET_CAPTURED:
+                stack_[slots + readOperand<std::uint16_t>(ip)].as<Upvalue>()->set(stack_.back());
+                break;
+            case OpCode::DEFINE_CAPTURED: {
+                // Every execution of the declaration creates a new cell, e.g. once per loop iteration
+                const auto slot = readOperand<std::uint16_t>(ip);
+                auto* cell = interpreter_.heap_.allocate<Upvalue>(stack_.back());
+                stack_.pop_back();
+                stack_[slots + slot] = cell;
+                collectGarbageIfNeeded();
+                break;
+            }
+            case OpCode::GET_UPVALUE:
+                stack_.push_back(frames_.back().function->getUpvalue(readOperand<std::uint16_t>(ip))->get());
+                break;
+            case OpCode::SET_UPVALUE:
+                frames_.back().function->getUpvalue(readOperand<std::uint16_t>(ip))->set(stack_.back());
+                break;
+            case OpCode::GET_GLOBAL:
+                stack_.push_back(interpreter_.globals_->get(readOperand<std::uint32_t>(ip)));
+                break;
+            case OpCode::SET_GLOBAL:
+                interpreter_.globals_->assign(readOperand<std::uint32_t>(ip), stack_.back());
+                break;
+            case OpCode::DEFINE_GLOBAL:
+                interpreter_.globals_->define(pop());
+                break;
+
+            case OpCode::GET_PROPERTY: {
+                const Token& name = chunk->tokens[readOperand<std::uint32_t>(ip)];
+                PropertyCache& cache = *chunk->caches[readOperand<std::uint32_t>(ip)];
+                LoxType object = pop();
+                if (!object.isObjType(ObjType::INSTANCE)) {
+                    throw RuntimeError(name, "Only instances have properties.");
+                }
+                stack_.push_back(interpreter_.getProperty(object.as<LoxInstance>(), name, cache));
+                collectGarbageIfNeeded();
+                break;
+            }
+            case OpCode::SET_PROPERTY: {
+                const Token& name = chunk->tokens[readOperand<std::uint32_t>(ip)];
+                PropertyCache& cache = *chunk->caches[readOperand<std::uint32_t>(ip)];
+                LoxType value = pop();
+                LoxType object = pop();
+                if (!object.isObjType(ObjType::INSTANCE)) {
+                    throw RuntimeError(name, "Only instances have properties.");
+                }
+                interpreter_.setProperty(object.as<LoxInstance>(), name, value, cache);
+                stack_.push_back(std::move(value));
+                break;
+            }
+            case OpCode::GET_SUPER: {
+                const Token& name = chunk->tokens[readOperand<std::uint32_t>(ip)];
+                PropertyCache& cache = *chunk->caches[readOperand<std::uint32_t>(ip)];
+
+                auto* super = pop().as<LoxClass>();
+                LoxType object = pop();
+                auto* method = interpreter_.getSuperMethod(super, name, cache);
+                stack_.emplace_back(method->bind(object.as<LoxInstance>(), interpreter_.heap_));
+                collectGarbageIfNeeded();
+                break;
+            }
+
+            case OpCode::EQUAL: {
+                LoxType right = pop();
+                stack_.back() = Interpreter::isEqual(stack_.back(), right);
+                break;
+            }
+            case OpCode::NOT_EQUAL: {
+                LoxType right = pop();
+                stack_.back() = !Interpreter::isEqual(stack_.back(), right);
+                break;
+            }
+            case OpCode::GREATER:
+            case OpCode::GREATER_EQUAL:
+            case OpCode::LESS:
+            case OpCode::LESS_EQUAL:
+            case OpCode::SUBTRACT:
+            case OpCode::MULTIPLY:
+            case OpCode::DIVIDE: {
+                const Token& token = chunk->tokens[readOperand<std::uint32_t>(ip)];
+                LoxType right = pop();
+                LoxType& left = stack_.back();
+                Interpreter::checkNumberOperands(token, left, right);
+
+                const double a = left.asNumber();
+                const double b = right.asNumber();
+                switch (op) {
+                    case OpCode::GREATER: left = a > b; break;
+                    case OpCode::GREATER_EQUAL: left = a >= b; break;
+                    case OpCode::LESS: left = a < b; break;
+                    case OpCode::LESS_EQUAL: left = a <= b; break;
+                    case OpCode::SUBTRACT: left = a - b; break;
+                    case OpCode::MULTIPLY: left = a * b; break;
+                    default: left = a / b; break;
+                }
+                break;
+            }
+            case OpCode::ADD: {
+                const Token& token = chunk->tokens[readOperand<std::uint32_t>(ip)];
+                LoxType right = pop();
+                LoxType& left = stack_.back();
+                left = interpreter_.add(token, left, right);
+                collectGarbageIfNeeded();
+                break;
+            }
+            case OpCode::NOT:
+                stack_.back() = !Interpreter::isTruthy(stack_.back());
+                break;
+            case OpCode::NEGATE: {
+                const Token& token = chunk->tokens[readOperand<std::uint32_t>(ip)];
+                stack_.back() = Interpreter::negate(token, stack_.back());
+                break;
+            }
+
+            case OpCode::PRINT:
+                printValue(*interpreter_.outputStream_, stack_.back(), interpreter_.numberFormat_);
+                *interpreter_.outputStream_ << '\n';
+                stack_.pop_back();
+                break;
+
+            case OpCode::JUMP: {
+                const auto offset = readOperand<std::int32_t>(ip);
+                ip += offset;
+                break;
+            }
+            case OpCode::JUMP_IF_FALSE: {
+                const auto offset = readOperand<std::int32_t>(ip);
+                if (!Interpreter::isTruthy(stack_.back())) { ip += offset; }
+                break;
+            }
+            case OpCode::JUMP_IF_TRUE: {
+                const auto offset = readOperand<std::int32_t>(ip);
+                if (Interpreter::isTruthy(stack_.back())) { ip += offset; }
+                break;
+            }
+            case OpCode::POP_JUMP_IF_FALSE: {
+                const auto offset = readOperand<std::int32_t>(ip);
+                if (!Interpreter::isTruthy(stack_.back())) { ip += offset; }
+                stack_.pop_back();
+                break;
+            }
+
+            case OpCode::CALL: {
+                const auto arg_count = readOperand<std::uint8_t>(ip);
+                const Token& paren = chunk->tokens[readOperand<std::uint32_t>(ip)];
+                frames_.back().ip = ip;
+
+                callValue(stack_[stack_.size() - arg_count - 1], arg_count, paren);
+
+                chunk = frames_.back().chunk;
+                ip = frames_.back().ip;
+                slots = frames_.back().slots;
+                collectGarbageIfNeeded();
+                break;
+            }
+            case OpCode::INVOKE: {
+                const auto arg_count = readOperand<std::uint8_t>(ip);
+                const Token& name = chunk->tokens[readOperand<std::uint32_t>(ip)];
+                const Token& paren = chunk->tokens[readOperand<std::uint32_t>(ip)];
+                PropertyCache& cache = *chunk->caches[readOperand<std::uint32_t>(ip)];
+                frames_.back().ip = ip;
+
+                invoke(name, paren, cache, arg_count);
+
+                chunk = frames_.back().chunk;
+                ip = frames_.back().ip;
+                slots = frames_.back().slots;
+                collectGarbageIfNeeded();
+                break;
+            }
+            case OpCode::CLOSURE: {
+                const auto& code = chunk->functions[readOperand<std::uint32_t>(ip)];
+                stack_.emplace_back(makeClosure(code, FunctionKind::FUNCTION));
+                collectGarbageIfNeeded();
+                break;
+            }
+            case OpCode::CLASS: {
+                const ClassCode& code = *chunk->classes[readOperand<std::uint32_t>(ip)];
+
+                LoxClass* superclass = nullptr;
+                if (code.superclass) {
+                    LoxType value = pop();
+                    if (!value.isObjType(ObjType::CLASS)) {
+                        throw RuntimeError(*code.superclass, "Superclass must be class");
+                    }
+                    superclass = value.as<LoxClass>();
+
+                    // Methods capture super, so its register has to be set before they are created
+                    LoxType& super = stack_[slots + code.superLocation.index];
+                    super = superclass;
+                    if (code.superLocation.captured) {
+                        super = interpreter_.heap_.allocate<Upvalue>(superclass);
+                    }
+                }
+
+                std::unordered_map<Token, LoxFunction*> methods;
+                for (const auto& method : code.methods) {
+                    methods[Token(TokenType::IDENTIFIER, method->name, 0)] =
+                            makeClosure(method, method->name == "init" ?
+                                                FunctionKind::INITIALIZER :
+                                                FunctionKind::METHOD);
+                }
+
+                if (superclass) {
+                    stack_.emplace_back(interpreter_.heap_.allocate<LoxClass>(std::string{code.name.getLexeme()},
+                                                                              methods, superclass));
+                } else {
+                    stack_.emplace_back(interpreter_.heap_.allocate<LoxClass>(std::string{code.name.getLexeme()},
+                                                                              methods));
+                }
+                collectGarbageIfNeeded();
+                break;
+            }
+            case OpCode::RETURN: {
+                LoxType result = pop();
+                CallFrame& frame = frames_.back();
+                if (frame.function && frame.function->isInitializer()) {
+                    result = frame.receiver;
+                }
+
+                stack_.resize(frame.stackBase);
+                frames_.pop_back();
+                if (frames_.size() == base_frame) {
+                    return result;
+                }
+
+                stack_.push_back(std::move(result));
+                chunk = frames_.back().chunk;
+                ip = frames_.back().ip;
+                slots = frames_.back().slots;
+                break;
+            }
+        }
+    }
+}
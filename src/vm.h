@@ -0,0 +1,81 @@
+#ifndef LOX_VM_H
+#define LOX_VM_H
+
+#include "chunk.h"
+#include "types.h"
+
+#include <memory>
+#include <vector>
+
+class Interpreter;
+class LoxFunction;
+class LoxInstance;
+enum class FunctionKind;
+
+/**
+ * Stack based virtual machine executing compiled chunks.
+ * It shares globals, upvalue cells and runtime objects with the
+ * tree-walking interpreter, so values can be passed freely between both.
+ */
+class VM {
+public:
+    /**
+     * Constructor
+     * @param interpreter interpreter providing globals, output and native calls
+     */
+    explicit VM(Interpreter& interpreter);
+
+    /**
+     * Execute a compiled top-level script in the global environment
+     * @param script chunk produced by the compiler
+     * @param slot_count registers needed by locals of the script, computed by the resolver
+     */
+    void interpret(const Chunk& script, std::size_t slot_count);
+
+    /**
+     * Call a compiled function from native code and run it to completion
+     * @param function function to call, has to carry compiled code
+     * @param receiver value of this for methods, null for functions
+     * @param arguments call arguments, copied into the parameter registers, may be a view of this VM's stack
+     * @return return value of the function
+     */
+    LoxType call(LoxFunction* function, LoxInstance* receiver, Arguments arguments);
+
+    /**
+     * Mark values on the stack and the functions of all active frames
+     * @param heap heap performing the collection
+     */
+    void markRoots(Heap& heap);
+
+private:
+    /**
+     * Activation record of a compiled function
+     */
+    struct CallFrame {
+        const Chunk* chunk;
+        const std::uint8_t* ip;
+        LoxFunction* function; // Null for the top-level script
+        std::size_t slots;     // Stack index of the first register
+        std::size_t stackBase; // Stack size to restore on return, the result replaces the callee
+        LoxInstance* receiver; // Value of this for methods
+    };
+
+    Interpreter& interpreter_;
+    std::vector<LoxType> stack_;
+    std::vector<CallFrame> frames_;
+
+    LoxType run(std::size_t base_frame);
+
+    void callValue(LoxType callee, int arg_count, const Token& paren);
+    void invoke(const Token& name, const Token& paren, PropertyCache& cache, int arg_count);
+    void pushFrame(LoxFunction* function, int arg_count, LoxInstance* receiver);
+    LoxFunction* makeClosure(const std::shared_ptr<FunctionCode>& code, FunctionKind kind);
+
+    // Called after instructions that allocate, when the state is consistent
+    void collectGarbageIfNeeded();
+
+    LoxType pop();
+};
+
+
+#endif //LOX_VM_H
@@ -3,23 +3,98 @@
 //
 
 #include "lox.h"
-
+#include "expressions.h"
+#include "scanner.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <limits>
+#include <string>
 #include <string_view>
+#include <vector>
 #include <gtest/gtest.h>
 
+/*!
+ * Interpreter settings of a test run, besides the engine
+ */
+struct InterpreterOptions {
+    std::size_t gcThreshold = 1024 * 1024;
+    double gcGrowth = 2.0;
+    NumberFormat numberFormat = NumberFormat::FIXED;
+};
+
+// Inspects the interpreter and its output after a run
+using RunCheck = std::function<void(const LoxInterpreter& interpreter, const std::string& out, const std::string& err)>;
+
+void runOnEngines(const std::function<void(LoxInterpreter&)>& run, const InterpreterOptions& options,
+                  const RunCheck& check) {
+    for (Engine engine : {Engine::TREE_WALKER, Engine::BYTECODE_VM}) {
+        std::stringstream out;
+        std::stringstream err;
+        std::shared_ptr<LoxInterpreter> interpreter = std::make_shared<LoxInterpreter>(&out, &err);
+        interpreter->setEngine(engine);
+        interpreter->configureHeap(options.gcThreshold, options.gcGrowth);
+        interpreter->setNumberFormat(options.numberFormat);
+        run(*interpreter);
+        check(*interpreter, out.str(), err.str());
+    }
+}
+
+void runOnEngines(const char* filename, const InterpreterOptions& options, const RunCheck& check) {
+    runOnEngines([&](LoxInterpreter& interpreter) { interpreter.runFile(filename); }, options, check);
+}
+
+void runOnEngines(std::string_view source, const InterpreterOptions& options, const RunCheck& check) {
+    runOnEngines([&](LoxInterpreter& interpreter) {
+        interpreter.run(std::make_shared<const SourceBuffer>(std::string{source}), false);
+    }, options, check);
+}
+
 void expectProgram(const char* filename,
                    std::string_view expected_stdout,
                    std::string_view expected_stderr) {
-    std::stringstream out;
-    std::stringstream err;
-    std::shared_ptr<LoxInterpreter> interpreter = std::make_shared<LoxInterpreter>(&out, &err);
-    interpreter->runFile(filename);
-    EXPECT_EQ(out.str(), expected_stdout);
-    EXPECT_EQ(err.str(), expected_stderr);
+    // Both engines have to produce identical output, also when collecting at every safe point
+    for (bool stress_gc : {false, true}) {
+        InterpreterOptions options;
+        if (stress_gc) {
+            options.gcThreshold = 0;
+            options.gcGrowth = 1.0;
+        }
+        runOnEngines(filename, options, [&](const LoxInterpreter&, const std::string& out, const std::string& err) {
+            EXPECT_EQ(out, expected_stdout);
+            EXPECT_EQ(err, expected_stderr);
+        });
+    }
 }
 
-TEST(LoxTests, BreakTest) {
-    expectProgram("examples/break.lox", "8281.000000\n", "");
+TEST(LoxTests, Arguments) {
+    expectProgram("examples/arguments.lox", "536.000000\n11.000000\n22.000000\n1\n",
+                  "[Expected 3 arguments but got 2. line 28]\n");
+}
+
+TEST(LoxTests, AstArena) {
+    AstArena arena;
+    auto literal = arena.make<Literal>(1.0);
+    auto access = arena.make<VariableAccess>(Token(TokenType::IDENTIFIER, "name", 1));
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(literal.get()) % AstArena::ALIGNMENT, 0);
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(access.get()) % AstArena::ALIGNMENT, 0);
+    EXPECT_EQ(access->getToken().getLexeme(), "name");
+
+    // Blocks larger than a chunk get a chunk of their own
+    auto* large = arena.allocate(2 * AstArena::MAX_CHUNK_SIZE);
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(large) % AstArena::ALIGNMENT, 0);
+    EXPECT_GE(arena.getBytesAllocated(), 2 * AstArena::MAX_CHUNK_SIZE + sizeof(Literal) + sizeof(VariableAccess));
+}
+
+TEST(LoxTests, Blocks) {
+    expectProgram("examples/blocks.lox", "2300.000000\n", "");
+
+    // Blocks and loop iterations live in registers, only the declarations at the top allocate
+    runOnEngines("examples/blocks.lox", {}, [](const LoxInterpreter& interpreter, const std::string&, const std::string&) {
+        EXPECT_LT(interpreter.getHeap().getStats().allocatedObjects, 10);
+    });
 }
 
 TEST(LoxTests, BreakErrorTest1) {
@@ -32,6 +107,25 @@ TEST(LoxTests, BreakErrorTest2) {
                   "[line 10] Error at 'break': Can only use break within loop\n");
 }
 
+TEST(LoxTests, BreakErrorTest3) {
+    expectProgram("examples/break_error_3.lox", "",
+                  "[line 4] Error at 'break': Can only use break within loop\n");
+}
+
+TEST(LoxTests, BreakErrorTest4) {
+    expectProgram("examples/break_error_4.lox", "",
+                  "[line 6] Error at 'break': Can only use break within loop\n");
+}
+
+TEST(LoxTests, BreakFunction) {
+    expectProgram("examples/break_function.lox",
+                  "1.000000\n5.000000\n10.000000\n16.000000\n23.000000\nnil\nnil\nnil\n", "");
+}
+
+TEST(LoxTests, BreakTest) {
+    expectProgram("examples/break.lox", "8281.000000\n", "");
+}
+
 TEST(LoxTests, ClassCall) {
     expectProgram("examples/class_call.lox", "", "");
 }
@@ -71,11 +165,6 @@ TEST(LoxTests, ClockTest) {
                   "");
 }
 
-TEST(LoxTests, CtorTest1) {
-    expectProgram("examples/ctor_1.lox", "The south German chocolate cake is delicious!\n",
-                  "");
-}
-
 TEST(LoxTests, ClosureTest) {
     expectProgram("examples/closure_test.lox", "global\nglobal\nblock\n",
                   "");
@@ -86,6 +175,25 @@ TEST(LoxTests, CounterTest) {
                   "");
 }
 
+TEST(LoxTests, CtorTest1) {
+    expectProgram("examples/ctor_1.lox", "The south German chocolate cake is delicious!\n",
+                  "");
+}
+
+TEST(LoxTests, ErrorOrder) {
+    expectProgram("examples/error_order.lox", "",
+                  "[line 2] Error at '=': Expect variable name.\n"
+                  "[line 4] Error : Unexpected character encountered\n"
+                  "[line 6] Error : Unterminated string.\n"
+                  "[line 6] Error  at end: Expect expression.\n");
+}
+
+TEST(LoxTests, Expressions) {
+    expectProgram("examples/expressions.lox",
+                  "6.000000\n25.000000\n1.000000\n2.000000\ndefault\n8.000000\nnil\n1\n"
+                  "11.000000\n10.000000\nxyy\n", "");
+}
+
 TEST(LoxTests, FibTest1) {
     expectProgram("examples/fib.lox", "0.000000\n1.000000\n1.000000\n2.000000\n3.000000\n"
                                       "5.000000\n8.000000\n13.000000\n21.000000\n34.000000\n55.000000\n89.000000"
@@ -102,11 +210,76 @@ TEST(LoxTests, FibTest2) {
                   "");
 }
 
+TEST(LoxTests, FieldsTest) {
+    expectProgram("examples/fields.lox", "3.000000\n12.000000\n3.000000\n8.000000\n",
+                  "");
+}
+
+TEST(LoxTests, Flush) {
+    expectProgram("examples/flush.lox", "before\nafter\nnil\n", "");
+}
+
+TEST(LoxTests, GcCycles) {
+    // Closures referencing their own environment form cycles, which have to be collected
+    runOnEngines("examples/gc_cycles.lox", {.gcThreshold = 64 * 1024, .gcGrowth = 2.0},
+                 [](const LoxInterpreter& interpreter, const std::string& out, const std::string& err) {
+        EXPECT_EQ(out, "10000.000000\n");
+        EXPECT_EQ(err, "");
+
+        const auto& stats = interpreter.getHeap().getStats();
+        EXPECT_GT(stats.collections, 0);
+        EXPECT_LT(stats.peakBytes, 256 * 1024);
+    });
+}
+
+TEST(LoxTests, GcLargeStrings) {
+    // Characters of strings count towards the threshold, not only the string objects
+    runOnEngines("examples/large_strings.lox", {},
+                 [](const LoxInterpreter& interpreter, const std::string& out, const std::string& err) {
+        EXPECT_EQ(out, "5000.000000\n");
+        EXPECT_EQ(err, "");
+
+        const auto& stats = interpreter.getHeap().getStats();
+        EXPECT_GT(stats.collections, 0);
+        EXPECT_GT(stats.allocatedBytes, 5000 * 240);
+    });
+}
+
+TEST(LoxTests, GcPool) {
+    // Closures and cells created per call reuse the memory of collected ones
+    runOnEngines("benchmarks/closures.lox", {.gcThreshold = 16 * 1024, .gcGrowth = 1.0},
+                 [](const LoxInterpreter& interpreter, const std::string&, const std::string& err) {
+        EXPECT_EQ(err, "");
+
+        const auto& heap = interpreter.getHeap();
+        EXPECT_GT(heap.getPool().getReused(), heap.getStats().allocatedObjects / 2);
+        EXPECT_LE(heap.getPool().getPooledBytes(), ObjectPool::LIMIT);
+    });
+}
+
+TEST(LoxTests, GcRopes) {
+    // Flattening a rope allocates its contents, which count towards the threshold
+    runOnEngines("examples/large_ropes.lox", {},
+                 [](const LoxInterpreter& interpreter, const std::string& out, const std::string& err) {
+        EXPECT_EQ(out, "20.000000\n");
+        EXPECT_EQ(err, "");
+
+        const auto& stats = interpreter.getHeap().getStats();
+        EXPECT_GT(stats.collections, 0);
+        EXPECT_LT(stats.peakBytes, 16 * 1024 * 1024);
+    });
+}
+
 TEST(LoxTests, HiTest) {
     expectProgram("examples/hi.lox", "Hi, Dear Reader!\n",
                   "");
 }
 
+TEST(LoxTests, IfTest1) {
+    expectProgram("examples/if_1.lox", "2.000000\n4.000000\n",
+                  "");
+}
+
 TEST(LoxTests, InheritanceTest1) {
     expectProgram("examples/inheritance_1.lox", "Fry until golden brown.\n",
                   "");
@@ -118,9 +291,19 @@ TEST(LoxTests, InheritanceTest2) {
                   "");
 }
 
-TEST(LoxTests, IfTest1) {
-    expectProgram("examples/if_1.lox", "2.000000\n4.000000\n",
-                  "");
+TEST(LoxTests, InlineCache) {
+    expectProgram("examples/inline_cache.lox", "ABCDE\nABCDE\nA\nfield\n", "");
+}
+
+TEST(LoxTests, InlineCacheStats) {
+    // Every access after the first one in the loop hits the cache
+    std::stringstream out;
+    std::stringstream err;
+    std::shared_ptr<LoxInterpreter> interpreter = std::make_shared<LoxInterpreter>(&out, &err);
+    interpreter->runFile("benchmarks/objects.lox");
+
+    const auto& stats = interpreter->getCacheStats();
+    EXPECT_GT(stats.hits, 100 * stats.misses);
 }
 
 TEST(LoxTests, InvalidThis) {
@@ -128,20 +311,119 @@ TEST(LoxTests, InvalidThis) {
                   "[line 1] Error at 'this': Can't use 'this' outside of a class.\n");
 }
 
+TEST(LoxTests, Invoke) {
+    expectProgram("examples/invoke.lox", "3.000000\n4.000000\n1\n10.000000\nn\n1.000000\n42.000000\n", "");
+}
+
 TEST(LoxTests, LogicalOps) {
     expectProgram("examples/logicalops.lox", "hi\nyes\n",
                   "");
 }
 
+TEST(LoxTests, NumberFormat) {
+    expectProgram("examples/numbers.lox", "1.000000\n0.100000\n0.333333\n-2.500000\n"
+                                          "999999999999999983222784.000000\nn2.000000\n0.500000n\n", "");
+
+    runOnEngines("examples/numbers.lox", {.numberFormat = NumberFormat::SHORTEST},
+                 [](const LoxInterpreter&, const std::string& out, const std::string& err) {
+        EXPECT_EQ(out, "1\n0.1\n0.3333333333333333\n-2.5\n1e+24\nn2\n0.5n\n");
+        EXPECT_EQ(err, "");
+    });
+}
+
+TEST(LoxTests, ObjTest1) {
+    expectProgram("examples/obj_1.lox", "Bagel instance\n",
+                  "");
+}
+
+TEST(LoxTests, OutputBuffer) {
+    // A tiny buffer, so output is written when it fills up and large writes bypass it
+    std::FILE* file = std::tmpfile();
+    ASSERT_NE(file, nullptr);
+    {
+        FileOutputBuffer buffer{fileno(file), 8};
+        std::ostream out{&buffer};
+        out << "abc" << 1 << '\n';
+        out << "a line longer than the buffer\n";
+        out.flush();
+        out << "rest";
+    }
+
+    std::string contents(64, '\0');
+    std::rewind(file);
+    contents.resize(std::fread(contents.data(), 1, contents.size(), file));
+    std::fclose(file);
+    EXPECT_EQ(contents, "abc1\na line longer than the buffer\nrest");
+}
+
+TEST(LoxTests, ParallelParse) {
+    // Large enough to be split into parts, with statements between the declarations
+    std::string source;
+    for (int i = 0; i < 2000; ++i) {
+        const auto n = std::to_string(i);
+        source += "fun f" + n + "(a) { if (a > 0) { return a + " + n + "; } return \"s" + n + "\"; }\n";
+        if (i % 100 == 0) { source += "class C" + n + " { m() { return f" + n + "(1); } } print C" + n + "().m();\n"; }
+    }
+    source += "print f1999(0);\n";
+    std::string broken = source;
+    broken.replace(broken.find("fun f500(a) {"), 13, "fun f500(a) { var = ;");
+    broken.replace(broken.find("fun f1500(a) {"), 14, "fun f1500(a) { @");
+
+    auto run = [](const std::string& text, unsigned threads) {
+        std::stringstream out;
+        std::stringstream err;
+        auto interpreter = std::make_shared<LoxInterpreter>(&out, &err);
+        interpreter->setParseThreads(threads);
+        interpreter->run(std::make_shared<const SourceBuffer>(text), false);
+        return out.str() + err.str();
+    };
+
+    const auto serial = run(source, 1);
+    EXPECT_EQ(serial.substr(0, 9), "1.000000\n");
+    EXPECT_EQ(serial.substr(serial.size() - 6), "s1999\n");
+    EXPECT_EQ(run(source, 4), serial);
+
+    // Errors make the parser start over on one thread, they are reported in order
+    const auto errors = run(broken, 1);
+    EXPECT_NE(errors.find("Expect variable name."), std::string::npos);
+    EXPECT_LT(errors.find("Expect variable name."), errors.find("Unexpected character"));
+    EXPECT_EQ(run(broken, 4), errors);
+
+    // Looking for the declarations to split after does not intern the literals again
+    std::stringstream out;
+    std::stringstream err;
+    auto interpreter = std::make_shared<LoxInterpreter>(&out, &err);
+    const auto allocated = interpreter->getHeap().getStats().allocatedObjects;
+    Scanner scanner{std::make_shared<const SourceBuffer>(source), interpreter};
+    scanner.setInternLiterals(false);
+    for (Token token = scanner.nextToken(); token.getType() != TokenType::EOF_TYPE; token = scanner.nextToken()) {
+        if (token.getType() == TokenType::STRING) { EXPECT_EQ(std::get<LoxString*>(token.getLiteral()), nullptr); }
+    }
+    EXPECT_EQ(interpreter->getHeap().getStats().allocatedObjects, allocated);
+}
+
+TEST(LoxTests, PermanentLiterals) {
+    // Literals are kept alive once, however often they are scanned
+    std::stringstream out;
+    std::stringstream err;
+    std::shared_ptr<LoxInterpreter> interpreter = std::make_shared<LoxInterpreter>(&out, &err);
+    auto line = std::make_shared<SourceBuffer>("print \"ab\" + \"ab\" + \"cd\";");
+    interpreter->run(line, true);
+    const auto permanent = interpreter->getHeap().getPermanentCount();
+    interpreter->run(line, true);
+    EXPECT_EQ(interpreter->getHeap().getPermanentCount(), permanent);
+    EXPECT_LE(permanent, 2);
+    EXPECT_EQ(out.str(), "ababcd\nababcd\n");
+}
+
 TEST(LoxTests, RecursionTest) {
     expectProgram("examples/recursion.lox", "1.000000\n2.000000\n3.000000\n4.000000\n5.000000"
                                             "\n6.000000\n7.000000\n8.000000\n9.000000\n10.000000\n",
                   "");
 }
 
-TEST(LoxTests, ObjTest1) {
-    expectProgram("examples/obj_1.lox", "Bagel instance\n",
-                  "");
+TEST(LoxTests, Resolution) {
+    expectProgram("examples/resolution.lox", "global\nglobal\nblock\ninner!inner\n", "");
 }
 
 TEST(LoxTests, ReturnTest) {
@@ -149,6 +431,18 @@ TEST(LoxTests, ReturnTest) {
                   "[line 1] Error at 'return': Can't return from top-level code.\n");
 }
 
+TEST(LoxTests, Ropes) {
+    std::string line;
+    for (int i = 0; i < 26; ++i) { line += "0123456789"; }
+    expectProgram("examples/ropes.lox", "1\n1\n0\n1\n1\n" + line + "\n", "");
+}
+
+TEST(LoxTests, Scanning) {
+    expectProgram("examples/scanning.lox",
+                  "a string literal\nthat spans\nthree lines\nquote after sixteen characters\nx\n",
+                  "[Undefined property 'property'. line 12]\n");
+}
+
 TEST(LoxTests, ScopeTest) {
     expectProgram("examples/scopes.lox", "inner a\nouter b\nglobal c\nouter a\nouter b\n"
                                          "global c\nglobal a\nglobal b\nglobal c\n",
@@ -160,11 +454,86 @@ TEST(LoxTests, ScopeTest2) {
                   "[line 3] Error at 'a': Can't read local variable in its own initializer\n");
 }
 
+TEST(LoxTests, SharedFunctions) {
+    expectProgram("examples/shared_functions.lox", "2.000000\n11.000000\n500500.000000\n", "");
+}
+
+TEST(LoxTests, SourceBuffer) {
+    auto mapped = SourceBuffer::fromFile("examples/break_error_1.lox");
+    ASSERT_NE(mapped, nullptr);
+    EXPECT_TRUE(mapped->isMapped());
+    EXPECT_EQ(mapped->getText(), "break;");
+
+    EXPECT_EQ(SourceBuffer::fromFile("examples/does_not_exist.lox"), nullptr);
+
+    SourceBuffer line{"print 1;"};
+    EXPECT_FALSE(line.isMapped());
+    EXPECT_EQ(line.getText(), "print 1;");
+
+    // Only sources of kept programs and expressions stay alive
+    std::stringstream out;
+    std::stringstream err;
+    std::shared_ptr<LoxInterpreter> interpreter = std::make_shared<LoxInterpreter>(&out, &err);
+    auto broken = std::make_shared<const SourceBuffer>("print ;");
+    interpreter->run(broken, true);
+    EXPECT_EQ(broken.use_count(), 1);
+    auto kept = std::make_shared<const SourceBuffer>("var a = 1;");
+    interpreter->run(kept, true);
+    EXPECT_EQ(kept.use_count(), 2);
+}
+
+TEST(LoxTests, Strings) {
+    expectProgram("examples/strings.lox", "1\n1\n0\n1\n1\n1\n", "");
+}
+
 TEST(LoxTests, Thrice) {
     expectProgram("examples/thrice.lox", "1.000000\n2.000000\n3.000000\n",
                   "");
 }
 
+TEST(LoxTests, Tokens) {
+    // Lexemes are views into the source, literals are decoded by the scanner
+    static_assert(sizeof(Token) <= 24);
+    std::stringstream out;
+    std::stringstream err;
+    std::shared_ptr<LoxInterpreter> interpreter = std::make_shared<LoxInterpreter>(&out, &err);
+    auto source = std::make_shared<SourceBuffer>("var s = \"ab\";\nprint s + 1.5;");
+    Scanner scanner{source, interpreter};
+
+    std::vector<Token> tokens;
+    do {
+        tokens.push_back(scanner.nextToken());
+    } while (tokens.back().getType() != TokenType::EOF_TYPE);
+    ASSERT_EQ(tokens.size(), 11);
+
+    const auto text = source->getText();
+    for (const auto& token : tokens) {
+        EXPECT_GE(token.getLexeme().data(), text.data());
+        EXPECT_LE(token.getLexeme().data() + token.getLexeme().size(), text.data() + text.size());
+    }
+    EXPECT_EQ(tokens[1].getLexeme(), "s");
+    EXPECT_EQ(tokens[3].getLexeme(), "\"ab\"");
+    EXPECT_EQ(std::get<LoxString*>(tokens[3].getLiteral())->getValue(), "ab");
+    EXPECT_EQ(tokens[5].getType(), TokenType::PRINT);
+    EXPECT_EQ(tokens[5].getLine(), 2);
+    EXPECT_EQ(std::get<double>(tokens[8].getLiteral()), 1.5);
+    EXPECT_EQ(err.str(), "");
+}
+
+TEST(LoxTests, TooManyLocals) {
+    // Registers of a function are addressed with 16 bits
+    std::string source = "{\n  var v0 = 0;\n";
+    for (int i = 1; i <= 65536; ++i) {
+        source += "  var v" + std::to_string(i) + " = v" + std::to_string(i - 1) + ";\n";
+    }
+    source += "  print v65536;\n}\n";
+
+    runOnEngines(std::string_view{source}, {}, [](const LoxInterpreter&, const std::string& out, const std::string& err) {
+        EXPECT_EQ(out, "");
+        EXPECT_EQ(err, "[line 65538] Error at 'v65536': Too many local variables in function.\n");
+    });
+}
+
 TEST(LoxTests, UndefinedVar1) {
     expectProgram("examples/undefined_var.lox", "",
                   "[line 1] Error at 'a': Undefined variable.\n");
@@ -175,6 +544,36 @@ TEST(LoxTests, Unused) {
                   "[line 2] Error at 'a': Local variable not used.\n");
 }
 
+TEST(LoxTests, Upvalues) {
+    expectProgram("examples/upvalues.lox", "2.000000\n7.000000\n0.000000\n1.000000\ndone\nbase!\nnil\n", "");
+}
+
+TEST(LoxTests, Values) {
+    expectProgram("examples/values.lox", "0\n0\n0\n1\n1\n0\n1\n1\n1\n1\n0\n", "");
+
+    // Numbers, including NaN, keep their bits, everything else lives in the NaN space
+    static_assert(sizeof(LoxType) == sizeof(double));
+    EXPECT_TRUE(LoxType{}.isNil());
+    EXPECT_TRUE(LoxType{true}.isBool());
+    EXPECT_TRUE(LoxType{true}.asBool());
+    EXPECT_FALSE(LoxType{false}.asBool());
+    EXPECT_FALSE(LoxType{false}.isNil());
+    EXPECT_EQ(LoxType{-2.5}.asNumber(), -2.5);
+    EXPECT_TRUE(std::signbit(LoxType{-0.0}.asNumber()));
+    EXPECT_TRUE(LoxType{std::numeric_limits<double>::quiet_NaN()}.isNumber());
+    EXPECT_TRUE(LoxType{-std::numeric_limits<double>::quiet_NaN()}.isNumber());
+    EXPECT_TRUE(std::isinf(LoxType{std::numeric_limits<double>::infinity()}.asNumber()));
+
+    std::stringstream out;
+    std::stringstream err;
+    std::shared_ptr<LoxInterpreter> interpreter = std::make_shared<LoxInterpreter>(&out, &err);
+    LoxString* string = interpreter->getHeap().intern(std::string_view{"boxed"});
+    LoxType value{static_cast<Obj*>(string)};
+    EXPECT_TRUE(value.isString());
+    EXPECT_FALSE(value.isNumber());
+    EXPECT_EQ(value.as<LoxString>(), string);
+}
+
 TEST(LoxTests, VarTest) {
     expectProgram("examples/var_test.lox", "",
                   "[line 3] Error at 'a': Can't read local variable in its own initializer\n");